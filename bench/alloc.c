@@ -0,0 +1,135 @@
+/* Benchmark of the harness allocator with several threads.
+ *
+ * Usage: bench/alloc [max threads]
+ *
+ * Every thread keeps a window of live blocks of random sizes, freeing a
+ * random one of them before each allocation, so that blocks are freed in no
+ * particular order. A quarter of the frees hand the block to the next thread
+ * instead, which frees it, so that blocks are also freed by threads other
+ * than the one allocating them. Each run must end with no block left and no
+ * error reported, whether every block is checked fully or one in 32.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "harness.h"
+
+#define OPS 1000000
+#define WINDOW 1024
+#define MAX_SIZE 256
+#define MAX_THREADS 64
+
+typedef struct {
+    pthread_mutex_t lock;
+    void *handed[WINDOW]; /* blocks handed over by the previous thread */
+    size_t count;
+} inbox_t;
+
+typedef struct {
+    pthread_t tid;
+    inbox_t *inbox, *next;
+    size_t ops;
+    uint64_t seed;
+} worker_t;
+
+/* Free the blocks handed to a thread */
+static void drain(inbox_t *inbox)
+{
+    pthread_mutex_lock(&inbox->lock);
+    for (size_t i = 0; i < inbox->count; i++)
+        test_free(inbox->handed[i]);
+    inbox->count = 0;
+    pthread_mutex_unlock(&inbox->lock);
+}
+
+/* Hand a block to the next thread, free it here if its inbox is full */
+static void hand(inbox_t *inbox, void *p)
+{
+    pthread_mutex_lock(&inbox->lock);
+    if (inbox->count < WINDOW) {
+        inbox->handed[inbox->count++] = p;
+        p = NULL;
+    }
+    pthread_mutex_unlock(&inbox->lock);
+    test_free(p);
+}
+
+static void *work(void *arg)
+{
+    worker_t *w = arg;
+    void *live[WINDOW] = {NULL};
+    for (size_t i = 0; i < w->ops; i++) {
+        uint64_t r = xorshift(&w->seed);
+        size_t slot = r % WINDOW;
+        if (live[slot]) {
+            if ((r >> 32) % 4)
+                test_free(live[slot]);
+            else
+                hand(w->next, live[slot]);
+        }
+        live[slot] = test_malloc(1 + (r >> 40) % MAX_SIZE);
+        if (i % WINDOW == 0)
+            drain(w->inbox);
+    }
+    for (size_t slot = 0; slot < WINDOW; slot++)
+        test_free(live[slot]);
+    return NULL;
+}
+
+/* Run OPS operations spread over n threads */
+static double run(int n)
+{
+    inbox_t inboxes[MAX_THREADS];
+    worker_t workers[MAX_THREADS];
+    for (int i = 0; i < n; i++) {
+        pthread_mutex_init(&inboxes[i].lock, NULL);
+        inboxes[i].count = 0;
+    }
+    for (int i = 0; i < n; i++) {
+        workers[i].inbox = &inboxes[i];
+        workers[i].next = &inboxes[(i + 1) % n];
+        workers[i].ops = OPS / n;
+        workers[i].seed = 88172645463325252ULL + i;
+    }
+    double t0 = now();
+    for (int i = 0; i < n; i++)
+        pthread_create(&workers[i].tid, NULL, work, &workers[i]);
+    for (int i = 0; i < n; i++)
+        pthread_join(workers[i].tid, NULL);
+    double t = now() - t0;
+    for (int i = 0; i < n; i++) {
+        drain(&inboxes[i]);
+        pthread_mutex_destroy(&inboxes[i].lock);
+    }
+    return t;
+}
+
+int main(int argc, char *argv[])
+{
+    int max = argc > 1 ? atoi(argv[1]) : 8;
+    if (max > MAX_THREADS)
+        max = MAX_THREADS;
+    bool ok = true;
+
+    printf("%8s %8s %14s %14s\n", "threads", "sample", "ns/op", "Mops/s");
+    for (int rate = 1; rate <= 32; rate *= 32) {
+        set_sample_rate(rate);
+        for (int n = 1; n <= max; n *= 2) {
+            double t = run(n);
+            printf("%8d %8d %14.1f %14.2f\n", n, rate, t * 1e9 / OPS,
+                   OPS / t * 1e-6);
+            size_t left = allocation_check();
+            if (left || error_check()) {
+                fprintf(stderr, "%zu blocks left, or errors, with %d threads\n",
+                        left, n);
+                ok = false;
+            }
+        }
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,8 @@
+# Cloning shares the strings, so it makes one allocation per element and
+# copies no string, compared with inserting the same number of strings.
+option fail 0
+option malloc 0
+new
+time it dolphin 1000000
+time clone
+time upcase
@@ -0,0 +1,14 @@
+# Compare the cost of the ready-made comparators on random strings. Most
+# random strings differ in length, so the length-first order skips strcmp
+# for the majority of comparisons.
+option fail 0
+option malloc 0
+new
+ih RAND 200000
+time sortby string
+new
+ih RAND 200000
+time sortby length
+new
+ih RAND 200000
+time sortby casefold
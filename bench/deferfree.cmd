@@ -0,0 +1,17 @@
+# Latency of freeing trace-14's 2M-element queue, first on the command loop
+# and then handed to the reclaimer thread. A small queue is kept alive so that
+# free does not wait for the reclaimer to check for leaks.
+option fail 0
+option malloc 0
+new
+it keep
+new
+ih dolphin 1000000
+it gerbil 1000000
+time free
+option deferfree 1
+new
+ih dolphin 1000000
+it gerbil 1000000
+time free
+time it x
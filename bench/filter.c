@@ -0,0 +1,106 @@
+/* Benchmark of the Bloom filter prefilter on large queues.
+ *
+ * Usage: bench/filter [elements] [false positive per mille]
+ *
+ * A queue of random lowercase strings, 1M by default, gets a filter with a
+ * 1% false positive rate by default. Lookups of missing values, the case the
+ * filter answers alone, and of queued values are timed with and without the
+ * filter, against the memory an index would take. Missing values which pass
+ * the filter cost a full scan, so they dominate the filtered time even at a
+ * fraction of a percent. Then q_delete_dup() runs on a queue with 1% of its
+ * values duplicated. Scans walk the whole queue, so far fewer of them are
+ * timed. Pass 10000000 elements to see the filter on a queue far larger than
+ * the caches.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "queue.h"
+
+#define VALUE_LEN 12
+#define MISSES 100000
+#define SCANS 5
+#define DEDUP 16384
+
+/* Time ops lookups of values from first on */
+static double lookup(struct list_head *q, uint64_t first, size_t ops)
+{
+    char buf[VALUE_LEN];
+    double t0 = now();
+    for (size_t i = 0; i < ops; i++) {
+        value_of(buf, VALUE_LEN, first + i * 7919);
+        q_contains(q, buf);
+    }
+    return (now() - t0) / ops;
+}
+
+static double run_dedup(double fp_rate)
+{
+    char buf[VALUE_LEN];
+    struct list_head *q = q_new();
+    q_set_filter(q, fp_rate);
+    for (size_t i = 0; i < DEDUP; i++) {
+        value_of(buf, VALUE_LEN, i % (DEDUP - DEDUP / 100));
+        q_insert_tail(q, buf);
+    }
+    double t0 = now();
+    q_delete_dup(q);
+    double t = now() - t0;
+    q_free(q);
+    return t;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    double fp_rate = (argc > 2 ? strtoul(argv[2], NULL, 10) : 10) / 1000.0;
+    char buf[VALUE_LEN];
+
+    struct list_head *q = q_new();
+    q_set_filter(q, fp_rate);
+    double t0 = now();
+    for (size_t i = 0; i < n; i++) {
+        value_of(buf, VALUE_LEN, i);
+        q_insert_tail(q, buf);
+    }
+    double t1 = now();
+
+    q_filter_stats_t st;
+    if (!q_filter_stats(q, &st)) {
+        fprintf(stderr, "Filter was dropped\n");
+        return 1;
+    }
+    size_t slots = 16;
+    while (n * 4 > slots * 3)
+        slots <<= 1;
+    printf("%zu elements built in %.2f s\n", n, t1 - t0);
+    printf("  filter: %.1f MiB (%.2f bytes/element), %d hashes, "
+           "fp %.3f%% estimated, %.3f%% targeted\n",
+           st.bytes / 1048576.0, (double) st.bytes / n, st.hashes,
+           st.fp_estimate * 100, st.fp_target * 100);
+    printf("  an index would take %.1f MiB\n", slots * 16 / 1048576.0);
+
+    /* Values past n were never inserted */
+    printf("missing values\n");
+    double filtered_miss = lookup(q, n, MISSES);
+    double filtered_hit = lookup(q, 0, SCANS);
+    q_set_filter(q, 0);
+    double scan_miss = lookup(q, n, SCANS);
+    double scan_hit = lookup(q, 0, SCANS);
+    printf("  filtered: %.1f ns/op, %.3f%% of them scanned\n",
+           filtered_miss * 1e9, st.fp_estimate * 100);
+    printf("  scan:     %.1f ns/op\n", scan_miss * 1e9);
+    printf("queued values, scanned either way\n");
+    printf("  filtered: %.1f ms/op\n", filtered_hit * 1e3);
+    printf("  scan:     %.1f ms/op\n", scan_hit * 1e3);
+    q_free(q);
+
+    printf("delete_dup of %d elements, 1%% duplicated\n", DEDUP);
+    printf("  filtered: %.3f s\n", run_dedup(fp_rate));
+    printf("  scan:     %.3f s\n", run_dedup(0));
+    return 0;
+}
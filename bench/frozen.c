@@ -0,0 +1,101 @@
+/* Benchmark of front-coded storage on typical string sets.
+ *
+ * Usage: bench/frozen [strings]
+ *
+ * Each set of strings, 1M by default, is sorted, frozen and thawed. The
+ * memory the strings take as queue elements is compared with their frozen
+ * size, and lookups by bisection in the frozen queue are timed.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "frozen.h"
+
+#define LOOKUPS 100000
+
+/* Random lowercase words of 5 to 9 letters, like RAND in qtest */
+static void gen_words(char *buf, uint64_t i)
+{
+    uint64_t s = i * 0x9e3779b97f4a7c15ULL + 1;
+    int len = 5 + xorshift(&s) % 5;
+    for (int k = 0; k < len; k++)
+        buf[k] = 'a' + xorshift(&s) % 26;
+    buf[len] = '\0';
+}
+
+/* Sequential identifiers */
+static void gen_ids(char *buf, uint64_t i)
+{
+    sprintf(buf, "user-%010lu", (unsigned long) i);
+}
+
+/* URLs of a few hosts with numeric paths */
+static void gen_urls(char *buf, uint64_t i)
+{
+    static const char *hosts[] = {"www.example.com", "api.example.org",
+                                  "static.example.net", "example.io"};
+    uint64_t s = i * 0x9e3779b97f4a7c15ULL + 1;
+    uint64_t r = xorshift(&s);
+    sprintf(buf, "https://%s/users/%lu/posts/%lu", hosts[r % 4],
+            (unsigned long) (r >> 8) % 100000,
+            (unsigned long) (r >> 32) % 1000);
+}
+
+static void run(const char *name, void (*gen)(char *, uint64_t), size_t n)
+{
+    char buf[128];
+    struct list_head *q = q_new();
+    for (size_t i = 0; i < n; i++) {
+        gen(buf, i);
+        q_insert_tail(q, buf);
+    }
+    q_sort(q, false);
+
+    double t0 = now();
+    q_frozen_t *frozen = q_freeze(q, false);
+    double t1 = now();
+    if (!frozen) {
+        fprintf(stderr, "Could not freeze %s\n", name);
+        exit(1);
+    }
+    q_frozen_stats_t st;
+    q_frozen_stats(frozen, &st);
+
+    uint64_t seed = 88172645463325252ULL;
+    size_t found = 0, index;
+    double t2 = now();
+    for (size_t i = 0; i < LOOKUPS; i++) {
+        gen(buf, xorshift(&seed) % n);
+        found += q_frozen_find(frozen, buf, &index);
+    }
+    double t3 = now();
+
+    if (!q_thaw(frozen, q)) {
+        fprintf(stderr, "Could not thaw %s\n", name);
+        exit(1);
+    }
+    double t4 = now();
+    q_free(q);
+
+    printf("%-6s %9zu %12zu %12zu %6.1f%% %8.3f %8.3f %8.1f%s\n", name, n,
+           st.list_bytes, st.bytes, 100.0 - 100.0 * st.bytes / st.list_bytes,
+           t1 - t0, t4 - t3, (t3 - t2) * 1e9 / LOOKUPS,
+           found == LOOKUPS ? "" : " MISSED");
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1 << 20;
+
+    printf("%-6s %9s %12s %12s %7s %8s %8s %8s\n", "set", "strings",
+           "list bytes", "frozen", "saved", "freeze s", "thaw s",
+           "find ns");
+    run("words", gen_words, n);
+    run("ids", gen_ids, n);
+    run("urls", gen_urls, n);
+    return 0;
+}
@@ -0,0 +1,108 @@
+/* Benchmark of lookups and deletions by value on large queues.
+ *
+ * Usage: bench/index [elements]
+ *
+ * A queue of random lowercase strings, 1M by default, is put through a mix of
+ * 90% q_contains() (half of them hits), 5% q_insert_tail() and 5%
+ * q_delete_value(), once with a hash index and once scanning the list. Then
+ * q_delete_dup() runs on a queue where every value appears once or twice. The
+ * scanning runs do far fewer operations since each one walks the whole queue.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "queue.h"
+
+#define VALUE_LEN 12
+#define SCAN_OPS 100
+#define SCAN_DEDUP 16384
+
+static struct list_head *build(size_t n, bool indexed)
+{
+    char buf[VALUE_LEN];
+    struct list_head *q = q_new();
+    q_set_index(q, indexed);
+    for (size_t i = 0; i < n; i++) {
+        value_of(buf, VALUE_LEN, i);
+        q_insert_tail(q, buf);
+    }
+    return q;
+}
+
+/* Run ops operations of the mix, return the time per operation */
+static double run_mix(struct list_head *q, size_t n, size_t ops, size_t *hits)
+{
+    uint64_t seed = 88172645463325252ULL;
+    char buf[VALUE_LEN];
+    size_t next = n;
+    double t0 = now();
+    for (size_t i = 0; i < ops; i++) {
+        uint64_t r = xorshift(&seed);
+        switch (r % 20) {
+        case 0:
+            value_of(buf, VALUE_LEN, next++);
+            q_insert_tail(q, buf);
+            break;
+        case 1:
+            value_of(buf, VALUE_LEN, (r >> 8) % next);
+            q_delete_value(q, buf);
+            break;
+        default:
+            /* Values past next were never inserted */
+            value_of(buf, VALUE_LEN, (r >> 8) % (2 * n));
+            *hits += q_contains(q, buf);
+        }
+    }
+    return (now() - t0) / ops;
+}
+
+static double run_dedup(size_t n, bool indexed)
+{
+    char buf[VALUE_LEN];
+    struct list_head *q = q_new();
+    q_set_index(q, indexed);
+    for (size_t i = 0; i < n; i++) {
+        value_of(buf, VALUE_LEN, i % (n * 3 / 4));
+        q_insert_tail(q, buf);
+    }
+    double t0 = now();
+    q_delete_dup(q);
+    double t = now() - t0;
+    q_free(q);
+    return t;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 1 << 20;
+
+    size_t hits = 0, scan_hits = 0;
+    double t0 = now();
+    struct list_head *q = build(n, true);
+    double t1 = now();
+    double indexed = run_mix(q, n, n, &hits);
+    q_free(q);
+    double t2 = now();
+    q = build(n, false);
+    double t3 = now();
+    double scan = run_mix(q, n, SCAN_OPS, &scan_hits);
+    q_free(q);
+
+    printf("%zu elements, 90%% contains / 5%% insert / 5%% delete_value\n", n);
+    printf("  indexed: build %.2f s, %.1f ns/op (%zu ops, %zu hits)\n",
+           t1 - t0, indexed * 1e9, n, hits);
+    printf("  scan:    build %.2f s, %.1f ns/op (%d ops, %zu hits)\n", t3 - t2,
+           scan * 1e9, SCAN_OPS, scan_hits);
+
+    printf("delete_dup with 1/3 of values duplicated\n");
+    printf("  indexed: %zu elements in %.3f s\n", n, run_dedup(n, true));
+    printf("  indexed: %d elements in %.3f s\n", SCAN_DEDUP,
+           run_dedup(SCAN_DEDUP, true));
+    printf("  scan:    %d elements in %.3f s\n", SCAN_DEDUP,
+           run_dedup(SCAN_DEDUP, false));
+    return 0;
+}
@@ -0,0 +1,53 @@
+# Stream sorted batches into a large sorted queue. The first half appends
+# each batch and sorts everything again through merge, the second half
+# merges the batch in place with mergein.
+option fail 0
+option malloc 0
+new
+ih RAND 200000
+sort
+new
+ih RAND 2000
+sort
+time merge
+new
+ih RAND 2000
+sort
+time merge
+new
+ih RAND 2000
+sort
+time merge
+new
+ih RAND 2000
+sort
+time merge
+new
+ih RAND 2000
+sort
+time merge
+free
+new
+ih RAND 200000
+sort
+new
+ih RAND 2000
+sort
+time mergein
+new
+ih RAND 2000
+sort
+time mergein
+new
+ih RAND 2000
+sort
+time mergein
+new
+ih RAND 2000
+sort
+time mergein
+new
+ih RAND 2000
+sort
+time mergein
+free
@@ -0,0 +1,19 @@
+# Compare string and numeric key throughput on the same kind of workload:
+# two queues of random decimal strings, one ordered with strcmp and one by
+# the key parsed at insert time.
+option fail 0
+option malloc 0
+option numeric 1
+new
+ih RAND 200000
+new
+ih RAND 200000
+# Queue 1 keeps numeric keys, queue 2 falls back to strcmp
+option numeric 0
+time sort
+time reverse
+time sort
+prev
+time sort
+time reverse
+time sort
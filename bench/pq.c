@@ -0,0 +1,101 @@
+/* Benchmark of the priority queue on a mixed push/pop workload.
+ *
+ * Usage: bench/pq [max operations]
+ *
+ * Every round pushes two random strings and pops the minimum once, then the
+ * remaining values are drained. The pairing heap is compared with the only
+ * option a plain queue offers: q_sort() after every insertion followed by
+ * q_remove_head(). Both must pop the same sequence. The baseline grows
+ * quadratically and is skipped past 16384 operations.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "pq.h"
+
+#define VALUE_LEN 16
+#define SORT_LIMIT 16384
+
+static void fill(char *buf, uint64_t *seed)
+{
+    for (int i = 0; i < VALUE_LEN - 1; i++)
+        buf[i] = 'a' + xorshift(seed) % 26;
+    buf[VALUE_LEN - 1] = '\0';
+}
+
+/* Run n operations, folding the popped sequence into a checksum */
+static double run_heap(size_t n, uint64_t *sum)
+{
+    uint64_t seed = 88172645463325252ULL;
+    char buf[VALUE_LEN];
+    pq_t *pq = pq_new(Q_KEY_STRING);
+    double t0 = now();
+    for (size_t i = 0; i < n; i += 3) {
+        for (int k = 0; k < 2; k++) {
+            fill(buf, &seed);
+            pq_push(pq, buf);
+        }
+        element_t *e = pq_pop_min(pq);
+        *sum = *sum * 31 + e->value[0] + e->value[VALUE_LEN - 2];
+        q_release_element(e);
+    }
+    for (element_t *e; (e = pq_pop_min(pq));) {
+        *sum = *sum * 31 + e->value[0] + e->value[VALUE_LEN - 2];
+        q_release_element(e);
+    }
+    double t = now() - t0;
+    pq_free(pq);
+    return t;
+}
+
+static double run_sort(size_t n, uint64_t *sum)
+{
+    uint64_t seed = 88172645463325252ULL;
+    char buf[VALUE_LEN];
+    struct list_head *q = q_new();
+    double t0 = now();
+    for (size_t i = 0; i < n; i += 3) {
+        for (int k = 0; k < 2; k++) {
+            fill(buf, &seed);
+            q_insert_tail(q, buf);
+            q_sort(q, false);
+        }
+        element_t *e = q_remove_head(q, buf, sizeof(buf));
+        *sum = *sum * 31 + e->value[0] + e->value[VALUE_LEN - 2];
+        q_release_element(e);
+    }
+    for (element_t *e; (e = q_remove_head(q, buf, sizeof(buf)));) {
+        *sum = *sum * 31 + e->value[0] + e->value[VALUE_LEN - 2];
+        q_release_element(e);
+    }
+    double t = now() - t0;
+    q_free(q);
+    return t;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t max = argc > 1 ? strtoul(argv[1], NULL, 10) : 1 << 20;
+    bool ok = true;
+
+    printf("%10s %14s %14s\n", "ops", "heap ns/op", "sort ns/op");
+    for (size_t n = 1024; n <= max; n *= 4) {
+        uint64_t heap_sum = 0, sort_sum = 0;
+        double heap = run_heap(n, &heap_sum);
+        if (n > SORT_LIMIT) {
+            printf("%10zu %14.1f %14s\n", n, heap * 1e9 / n, "-");
+            continue;
+        }
+        double sort = run_sort(n, &sort_sum);
+        printf("%10zu %14.1f %14.1f\n", n, heap * 1e9 / n, sort * 1e9 / n);
+        if (heap_sum != sort_sum) {
+            fprintf(stderr, "Pop sequences differ at %zu operations\n", n);
+            ok = false;
+        }
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,15 @@
+# Sweep k for reverseK on a 1M-element queue against a plain reverse
+option fail 0
+option malloc 0
+new
+it dolphin 1000000
+time reverse
+time reverseK 2
+time reverseK 3
+time reverseK 8
+time reverseK 64
+time reverseK 1024
+time reverseK 65536
+time reverseK 1000000
+time reverseK 1000001
+time reverse
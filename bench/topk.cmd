@@ -0,0 +1,17 @@
+# Selecting a few elements should not cost a full sort. topk sorts batches
+# of k and skips most elements once the top k is full, and nth partitions
+# around random pivots.
+option fail 0
+option malloc 0
+new
+ih RAND 200000
+time topk 10
+new
+ih RAND 200000
+time topk 1000
+new
+ih RAND 200000
+time nth 100000
+new
+ih RAND 200000
+time sort
@@ -69,8 +69,6 @@ static void init_in();
 static bool push_file(char *fname);
 static void pop_file();
 
-static bool interpret_cmda(int argc, char *argv[]);
-
 /* Add a new command */
 void add_cmd(char *name, cmd_func_t operation, char *summary, char *param)
 {
@@ -167,7 +165,7 @@ static void record_error()
 }
 
 /* Execute a command that has already been split into arguments */
-static bool interpret_cmda(int argc, char *argv[])
+bool interpret_cmda(int argc, char *argv[])
 {
     if (argc == 0)
         return true;
@@ -53,6 +53,11 @@ void add_param(char *name, int *valp, char *summary, setter_func_t setter);
 /* Extract integer from text and store at loc */
 bool get_int(char *vname, int *loc);
 
+/* Execute a command that has already been split into arguments, as done by
+ * commands running another one.  Return true if no errors occurred
+ */
+bool interpret_cmda(int argc, char *argv[]);
+
 /* Add function to be executed as part of program exit */
 void add_quit_helper(cmd_func_t qf);
 
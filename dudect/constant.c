@@ -14,12 +14,6 @@ static struct list_head *l = NULL;
 
 #define dut_new() ((void) (l = q_new()))
 
-#define dut_size(n)                                \
-    do {                                           \
-        for (int __iter = 0; __iter < n; ++__iter) \
-            q_size(l);                             \
-    } while (0)
-
 #define dut_insert_head(s, n)    \
     do {                         \
         int j = n;               \
@@ -27,22 +21,41 @@ static struct list_head *l = NULL;
             q_insert_head(l, s); \
     } while (0)
 
-#define dut_insert_tail(s, n)    \
-    do {                         \
-        int j = n;               \
-        while (j--)              \
-            q_insert_tail(l, s); \
-    } while (0)
-
-#define dut_free() ((void) (q_free(l)))
-
 static char random_string[N_MEASURES][8];
 static int random_string_iter = 0;
 
+/* String inserted by the operation measured */
+static char *dut_string;
+
+/* Element removed by the operation measured, released after timing it */
+static element_t *dut_removed;
+
+static void dut_free(void)
+{
+    if (dut_removed)
+        q_release_element(dut_removed);
+    dut_removed = NULL;
+    q_free(l);
+}
+
+/**
+ * dut_op_t - An operation under test
+ * @setup: build the queue of a measurement from its input chunk and class
+ * @run: the operation timed, applied to the queue
+ * @check: tell whether the operation did its job, given the size of the queue
+ *         before and after it
+ */
+typedef struct {
+    void (*setup)(const uint8_t *input, uint8_t class);
+    void (*run)(void);
+    bool (*check)(int before_size, int after_size);
+} dut_op_t;
+
 /* Implement the necessary queue interface to simulation */
 void init_dut(void)
 {
     l = NULL;
+    dut_removed = NULL;
 }
 
 static char *get_random_string(void)
@@ -67,96 +80,152 @@ void prepare_inputs(uint8_t *input_data, uint8_t *classes)
     }
 }
 
+/* Set-ups: the classes differ by length, class 0 having the shortest queue */
+
+static int chunk_length(const uint8_t *input)
+{
+    return *(uint16_t *) input % 10000;
+}
+
+static void setup_length(const uint8_t *input, uint8_t class)
+{
+    dut_string = get_random_string();
+    dut_new();
+    dut_insert_head(get_random_string(), chunk_length(input));
+}
+
+static void setup_nonempty(const uint8_t *input, uint8_t class)
+{
+    dut_new();
+    dut_insert_head(get_random_string(), chunk_length(input) + 1);
+}
+
+static void setup_counted(const uint8_t *input, uint8_t class)
+{
+    dut_new();
+    q_set_counted(l, true);
+    dut_insert_head(get_random_string(), chunk_length(input));
+}
+
+/* Set-ups: the classes differ by contents, class 0 holding one value */
+
+static void setup_contents(const uint8_t *input, uint8_t class)
+{
+    char *s = get_random_string();
+    dut_new();
+    for (int i = 0; i < DUT_LENGTH; i++)
+        q_insert_head(l, class ? get_random_string() : s);
+}
+
+/* Class 0 is sorted already, class 1 is in random order */
+static void setup_sorted(const uint8_t *input, uint8_t class)
+{
+    dut_new();
+    for (int i = 0; i < DUT_LENGTH; i++)
+        q_insert_head(l, get_random_string());
+    if (!class)
+        q_sort(l, false);
+}
+
+static void run_insert_head(void)
+{
+    q_insert_head(l, dut_string);
+}
+
+static void run_insert_tail(void)
+{
+    q_insert_tail(l, dut_string);
+}
+
+static void run_remove_head(void)
+{
+    dut_removed = q_remove_head(l, NULL, 0);
+}
+
+static void run_remove_tail(void)
+{
+    dut_removed = q_remove_tail(l, NULL, 0);
+}
+
+/* A single call is within the noise of the cycle counter, time a run of them */
+static void run_size(void)
+{
+    for (int i = 0; i < DUT_REPEAT; i++)
+        q_size(l);
+}
+
+static void run_swap(void)
+{
+    q_swap(l);
+}
+
+static void run_delete_mid(void)
+{
+    q_delete_mid(l);
+}
+
+static void run_sort(void)
+{
+    q_sort(l, false);
+}
+
+static bool grown(int before_size, int after_size)
+{
+    return before_size == after_size - 1;
+}
+
+static bool shrunk(int before_size, int after_size)
+{
+    return before_size == after_size + 1;
+}
+
+static bool kept(int before_size, int after_size)
+{
+    return before_size == after_size;
+}
+
+static bool sorted(int before_size, int after_size)
+{
+    element_t *e, *prev = NULL;
+    list_for_each_entry (e, l, list) {
+        if (prev && strcmp(prev->value, e->value) > 0)
+            return false;
+        prev = e;
+    }
+    return kept(before_size, after_size);
+}
+
+static const dut_op_t dut_ops[] = {
+    [DUT(insert_head)] = {setup_length, run_insert_head, grown},
+    [DUT(insert_tail)] = {setup_length, run_insert_tail, grown},
+    [DUT(remove_head)] = {setup_nonempty, run_remove_head, shrunk},
+    [DUT(remove_tail)] = {setup_nonempty, run_remove_tail, shrunk},
+    [DUT(size)] = {setup_counted, run_size, kept},
+    [DUT(swap)] = {setup_contents, run_swap, kept},
+    [DUT(delete_mid)] = {setup_contents, run_delete_mid, shrunk},
+    [DUT(sort)] = {setup_sorted, run_sort, sorted},
+};
+
 bool measure(int64_t *before_ticks,
              int64_t *after_ticks,
              uint8_t *input_data,
+             uint8_t *classes,
              int mode)
 {
-    assert(mode == DUT(insert_head) || mode == DUT(insert_tail) ||
-           mode == DUT(remove_head) || mode == DUT(remove_tail));
-
-    switch (mode) {
-    case DUT(insert_head):
-        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
-            char *s = get_random_string();
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000);
-            int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
-            dut_insert_head(s, 1);
-            after_ticks[i] = cpucycles();
-            int after_size = q_size(l);
-            dut_free();
-            if (before_size != after_size - 1)
-                return false;
-        }
-        break;
-    case DUT(insert_tail):
-        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
-            char *s = get_random_string();
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000);
-            int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
-            dut_insert_tail(s, 1);
-            after_ticks[i] = cpucycles();
-            int after_size = q_size(l);
-            dut_free();
-            if (before_size != after_size - 1)
-                return false;
-        }
-        break;
-    case DUT(remove_head):
-        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000 + 1);
-            int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
-            element_t *e = q_remove_head(l, NULL, 0);
-            after_ticks[i] = cpucycles();
-            int after_size = q_size(l);
-            if (e)
-                q_release_element(e);
-            dut_free();
-            if (before_size != after_size + 1)
-                return false;
-        }
-        break;
-    case DUT(remove_tail):
-        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000 + 1);
-            int before_size = q_size(l);
-            before_ticks[i] = cpucycles();
-            element_t *e = q_remove_tail(l, NULL, 0);
-            after_ticks[i] = cpucycles();
-            int after_size = q_size(l);
-            if (e)
-                q_release_element(e);
-            dut_free();
-            if (before_size != after_size + 1)
-                return false;
-        }
-        break;
-    default:
-        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000);
-            before_ticks[i] = cpucycles();
-            dut_size(1);
-            after_ticks[i] = cpucycles();
-            dut_free();
-        }
+    assert(mode >= 0 && mode < (int) (sizeof(dut_ops) / sizeof(dut_ops[0])));
+    const dut_op_t *op = &dut_ops[mode];
+
+    for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
+        op->setup(input_data + i * CHUNK_SIZE, classes[i]);
+        int before_size = q_size(l);
+        before_ticks[i] = cpucycles();
+        op->run();
+        after_ticks[i] = cpucycles();
+        int after_size = q_size(l);
+        bool ok = op->check(before_size, after_size);
+        dut_free();
+        if (!ok)
+            return false;
     }
     return true;
 }
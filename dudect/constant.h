@@ -12,11 +12,24 @@
 
 #define DROP_SIZE 20
 
+/* Length of the queues of operations whose classes differ by contents */
+#define DUT_LENGTH 256
+
+/* Calls per measurement of operations too quick to time one by one */
+#define DUT_REPEAT 100
+
+/* Operations under test, each registered in constant.c with the way its
+ * queue is built for either class of input and the checks of its result
+ */
 #define DUT_FUNCS  \
     _(insert_head) \
     _(insert_tail) \
     _(remove_head) \
-    _(remove_tail)
+    _(remove_tail) \
+    _(size)        \
+    _(swap)        \
+    _(delete_mid)  \
+    _(sort)
 
 #define DUT(x) DUT_##x
 
@@ -31,6 +44,7 @@ void prepare_inputs(uint8_t *input_data, uint8_t *classes);
 bool measure(int64_t *before_ticks,
              int64_t *after_ticks,
              uint8_t *input_data,
+             uint8_t *classes,
              int mode);
 
 #endif
@@ -9,4 +9,7 @@
 DUT_FUNCS
 #undef _
 
+/* Mean execution time in cycles of inputs of class 0 and 1 in the last test */
+void dut_class_means(double *mean0, double *mean1);
+
 #endif
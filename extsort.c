@@ -0,0 +1,487 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "extsort.h"
+
+/* Largest stdio buffer given to a single file */
+#define EXT_MAX_IO_BUF (1 << 20)
+#define EXT_MIN_IO_BUF 4096
+
+/* Memory accounted to an element holding a string of length len */
+#define ELEMENT_COST(len) (sizeof(element_t) + (len) + 1)
+
+/* A sorted run spilled to a temporary file */
+typedef struct {
+    FILE *fp;
+    char *buf; /* stdio buffer of fp */
+    struct list_head list;
+} run_t;
+
+typedef struct {
+    bool descend;
+    bool numeric;
+    size_t batch;  /* bytes of elements sorted in memory at once */
+    size_t io_buf; /* bytes of every stdio buffer */
+    int fanin;     /* runs merged at once */
+    int nr_runs;
+    struct list_head runs;
+} ext_t;
+
+/* Current record of a run being merged */
+typedef struct {
+    run_t *run;
+    element_t e;
+    size_t cap; /* allocated size of e.value */
+    int order;  /* position of the run, earlier runs win ties */
+} cursor_t;
+
+/* Receives the merged records in order */
+typedef bool (*sink_t)(void *priv, element_t *e, bool numeric);
+
+static void ext_init(ext_t *x, bool descend, bool numeric, size_t budget)
+{
+    if (budget < EXTSORT_MIN_BUDGET)
+        budget = EXTSORT_MIN_BUDGET;
+    x->descend = descend;
+    x->numeric = numeric;
+    x->io_buf = budget / 16;
+    if (x->io_buf < EXT_MIN_IO_BUF)
+        x->io_buf = EXT_MIN_IO_BUF;
+    else if (x->io_buf > EXT_MAX_IO_BUF)
+        x->io_buf = EXT_MAX_IO_BUF;
+    /* One buffer for the run being written, one for the input file */
+    x->batch = budget - 2 * x->io_buf;
+    x->fanin = budget / x->io_buf - 1;
+    x->nr_runs = 0;
+    INIT_LIST_HEAD(&x->runs);
+}
+
+static void run_close(run_t *run)
+{
+    fclose(run->fp);
+    free(run->buf);
+    free(run);
+}
+
+static void ext_release(ext_t *x)
+{
+    run_t *run, *safe;
+    list_for_each_entry_safe (run, safe, &x->runs, list) {
+        list_del(&run->list);
+        run_close(run);
+    }
+    x->nr_runs = 0;
+}
+
+/* Create an empty run. The file is unlinked right away, so it disappears
+ * when closed, even if the program is killed.
+ */
+static run_t *run_open(const ext_t *x)
+{
+    const char *dir = getenv("TMPDIR");
+    char path[4096];
+    if (!dir || !*dir)
+        dir = "/tmp";
+    if (snprintf(path, sizeof(path), "%s/lab0-extsort-XXXXXX", dir) >=
+        (int) sizeof(path))
+        return NULL;
+
+    run_t *run = malloc(sizeof(run_t));
+    if (!run)
+        return NULL;
+    run->buf = malloc(x->io_buf);
+    int fd = mkstemp(path);
+    if (fd >= 0)
+        unlink(path);
+    run->fp = fd >= 0 ? fdopen(fd, "w+") : NULL;
+    if (!run->buf || !run->fp) {
+        if (run->fp)
+            fclose(run->fp);
+        else if (fd >= 0)
+            close(fd);
+        free(run->buf);
+        free(run);
+        return NULL;
+    }
+    setvbuf(run->fp, run->buf, _IOFBF, x->io_buf);
+    return run;
+}
+
+/* Records are the length of the string as a LEB128 varint, the key as a
+ * zigzag varint for numeric sorts, then the bytes of the string. Short
+ * strings and small keys take a single byte of overhead each.
+ */
+static bool put_varint(FILE *fp, uint64_t v)
+{
+    do {
+        int c = v & 0x7f;
+        v >>= 7;
+        if (putc_unlocked(v ? c | 0x80 : c, fp) == EOF)
+            return false;
+    } while (v);
+    return true;
+}
+
+/* Return 1 for a value, 0 at end of file, -1 for a truncated value */
+static int get_varint(FILE *fp, uint64_t *v)
+{
+    uint64_t x = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = getc_unlocked(fp);
+        if (c == EOF)
+            return shift ? -1 : 0;
+        x |= (uint64_t) (c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            *v = x;
+            return 1;
+        }
+    }
+    return -1;
+}
+
+static bool put_record(void *priv, element_t *e, bool numeric)
+{
+    FILE *fp = priv;
+    if (!put_varint(fp, e->len))
+        return false;
+    if (numeric &&
+        !put_varint(fp, ((uint64_t) e->key << 1) ^ (uint64_t) (e->key >> 63)))
+        return false;
+    return fwrite(e->value, 1, e->len, fp) == e->len;
+}
+
+/* Make room for at least need bytes in *buf, keeping its content */
+static bool grow(char **buf, size_t *cap, size_t need)
+{
+    if (need <= *cap)
+        return true;
+    size_t size = *cap ? *cap * 2 : 64;
+    while (size < need)
+        size *= 2;
+    char *p = malloc(size);
+    if (!p)
+        return false;
+    if (*buf) {
+        memcpy(p, *buf, *cap);
+        free(*buf);
+    }
+    *buf = p;
+    *cap = size;
+    return true;
+}
+
+/* Return 1 for a record, 0 at end of run, -1 for an error */
+static int get_record(cursor_t *c, bool numeric)
+{
+    FILE *fp = c->run->fp;
+    uint64_t len, key = 0;
+    int r = get_varint(fp, &len);
+    if (r <= 0)
+        return r;
+    if (numeric && get_varint(fp, &key) <= 0)
+        return -1;
+    if (!grow(&c->e.value, &c->cap, len + 1) ||
+        fread(c->e.value, 1, len, fp) != len)
+        return -1;
+    c->e.value[len] = '\0';
+    c->e.len = len;
+    c->e.key = (int64_t) (key >> 1) ^ -(int64_t) (key & 1);
+    return 1;
+}
+
+static bool cursor_before(const ext_t *x, const cursor_t *a, const cursor_t *b)
+{
+    q_cmp_func_t cmp = x->numeric ? q_cmp_numeric : q_cmp_string;
+    int r = x->descend ? cmp(NULL, &b->e, &a->e) : cmp(NULL, &a->e, &b->e);
+    return r ? r < 0 : a->order < b->order;
+}
+
+static void sift_down(const ext_t *x, cursor_t **heap, int n, int i)
+{
+    for (;;) {
+        int min = i, l = 2 * i + 1, r = l + 1;
+        if (l < n && cursor_before(x, heap[l], heap[min]))
+            min = l;
+        if (r < n && cursor_before(x, heap[r], heap[min]))
+            min = r;
+        if (min == i)
+            return;
+        cursor_t *tmp = heap[i];
+        heap[i] = heap[min];
+        heap[min] = tmp;
+        i = min;
+    }
+}
+
+/* Merge the first k runs into sink with a heap of their current records.
+ * The runs are closed whether or not the merge succeeds.
+ */
+static bool merge_front(ext_t *x, int k, sink_t sink, void *priv)
+{
+    cursor_t *cursors = malloc(k * sizeof(cursor_t));
+    cursor_t **heap = malloc(k * sizeof(cursor_t *));
+    bool ok = cursors && heap;
+    int opened = 0, n = 0;
+    for (int i = 0; i < k; i++) {
+        run_t *run = list_first_entry(&x->runs, run_t, list);
+        list_del(&run->list);
+        x->nr_runs--;
+        if (!ok) {
+            run_close(run);
+            continue;
+        }
+        cursor_t *c = &cursors[opened++];
+        c->run = run;
+        c->e.value = NULL;
+        c->cap = 0;
+        c->order = i;
+        rewind(run->fp);
+        int r = get_record(c, x->numeric);
+        if (r > 0)
+            heap[n++] = c;
+        ok = r >= 0;
+    }
+    for (int i = n / 2 - 1; i >= 0; i--)
+        sift_down(x, heap, n, i);
+
+    while (ok && n) {
+        cursor_t *c = heap[0];
+        ok = sink(priv, &c->e, x->numeric);
+        int r = get_record(c, x->numeric);
+        if (r <= 0) {
+            ok = ok && !r;
+            heap[0] = heap[--n];
+        }
+        sift_down(x, heap, n, 0);
+    }
+
+    for (int i = 0; i < opened; i++) {
+        free(cursors[i].e.value);
+        run_close(cursors[i].run);
+    }
+    free(heap);
+    free(cursors);
+    return ok;
+}
+
+/* Merge all runs into sink, first in passes of x->fanin runs while there are
+ * more. Each pass merges neighboring runs and keeps them in order, so ties
+ * still resolve to the earliest input.
+ */
+static bool merge_runs(ext_t *x, sink_t sink, void *priv)
+{
+    while (x->nr_runs > x->fanin) {
+        LIST_HEAD(merged);
+        int nr_merged = 0;
+        while (x->nr_runs) {
+            run_t *out = run_open(x);
+            if (!out) {
+                list_splice(&merged, &x->runs);
+                x->nr_runs += nr_merged;
+                return false;
+            }
+            int k = x->nr_runs < x->fanin ? x->nr_runs : x->fanin;
+            bool ok = merge_front(x, k, put_record, out->fp);
+            list_add_tail(&out->list, &merged);
+            nr_merged++;
+            if (!ok || fflush(out->fp)) {
+                list_splice(&merged, &x->runs);
+                x->nr_runs += nr_merged;
+                return false;
+            }
+        }
+        list_splice(&merged, &x->runs);
+        x->nr_runs = nr_merged;
+    }
+    return x->nr_runs ? merge_front(x, x->nr_runs, sink, priv) : true;
+}
+
+/* Sort the batch and append it to the runs as a new one. The elements are
+ * only released once the whole run is written, so the batch is left intact
+ * on failure.
+ */
+static bool spill(ext_t *x, struct list_head *batch)
+{
+    q_sort(batch, x->descend);
+    run_t *run = run_open(x);
+    if (!run)
+        return false;
+    element_t *e, *safe;
+    bool ok = true;
+    list_for_each_entry (e, batch, list) {
+        if (!(ok = put_record(run->fp, e, x->numeric)))
+            break;
+    }
+    if (!ok || fflush(run->fp)) {
+        run_close(run);
+        return false;
+    }
+    list_for_each_entry_safe (e, safe, batch, list) {
+        list_del(&e->list);
+        q_release_element(e);
+    }
+    list_add_tail(&run->list, &x->runs);
+    x->nr_runs++;
+    return true;
+}
+
+/* Records carry the length and key already, nothing is parsed again */
+static bool put_queue(void *priv, element_t *e, bool numeric)
+{
+    return q_insert_tail_copy(priv, e);
+}
+
+/* Sort queue through temporary files */
+bool q_sort_external(struct list_head *head, bool descend, size_t budget)
+{
+    if (!head || list_empty(head))
+        return true;
+    ext_t x;
+    q_key_mode_t mode = q_key_mode(head);
+    ext_init(&x, descend, mode == Q_KEY_NUMERIC, budget);
+
+    struct list_head *batch = q_new();
+    if (!batch)
+        return false;
+    q_set_key_mode(batch, mode);
+
+    /* Spilled elements leave the queue behind the back of its count, index
+     * and filter, which are rebuilt once they are all back
+     */
+    bool counted = q_counted(head);
+    bool indexed = q_indexed(head);
+    q_filter_stats_t filter;
+    bool filtered = q_filter_stats(head, &filter);
+    q_set_counted(head, false);
+    q_set_index(head, false);
+    q_set_filter(head, 0);
+
+    bool ok = true;
+    while (ok && !list_empty(head)) {
+        size_t used = 0;
+        while (!list_empty(head) && used < x.batch) {
+            element_t *e = list_first_entry(head, element_t, list);
+            used += ELEMENT_COST(e->len);
+            list_move_tail(&e->list, batch);
+        }
+        /* Everything fits, no need for files */
+        if (!x.nr_runs && list_empty(head))
+            break;
+        ok = spill(&x, batch);
+    }
+
+    /* Whatever could not be spilled is merged back in memory */
+    list_splice_tail_init(head, batch);
+    ok = merge_runs(&x, put_queue, head) && ok;
+    if (!list_empty(batch)) {
+        list_splice_tail_init(batch, head);
+        q_sort(head, descend);
+    }
+    ext_release(&x);
+    q_free(batch);
+    if (counted)
+        q_set_counted(head, true);
+    if (indexed)
+        q_set_index(head, true);
+    if (filtered)
+        q_set_filter(head, filter.fp_target);
+    return ok;
+}
+
+/* Read one line into *buf, without its newline.
+ * Return the length, -1 at end of file and -2 on error.
+ */
+static long read_line(FILE *fp, char **buf, size_t *cap)
+{
+    size_t len = 0;
+    int c;
+    while ((c = getc_unlocked(fp)) != EOF && c != '\n') {
+        if (!grow(buf, cap, len + 2))
+            return -2;
+        (*buf)[len++] = c;
+    }
+    if (ferror(fp))
+        return -2;
+    if (c == EOF && !len)
+        return -1;
+    if (!grow(buf, cap, len + 1))
+        return -2;
+    (*buf)[len] = '\0';
+    return len;
+}
+
+static bool put_line(void *priv, element_t *e, bool numeric)
+{
+    FILE *fp = priv;
+    return fwrite(e->value, 1, e->len, fp) == e->len &&
+           putc_unlocked('\n', fp) != EOF;
+}
+
+/* Sort the lines of a file into another file */
+bool extsort_file(const char *in,
+                  const char *out,
+                  bool descend,
+                  bool numeric,
+                  size_t budget)
+{
+    ext_t x;
+    ext_init(&x, descend, numeric, budget);
+
+    FILE *fp = fopen(in, "r");
+    char *iobuf = malloc(x.io_buf);
+    struct list_head *batch = q_new();
+    if (!fp || !iobuf || !batch) {
+        if (fp)
+            fclose(fp);
+        free(iobuf);
+        q_free(batch);
+        return false;
+    }
+    setvbuf(fp, iobuf, _IOFBF, x.io_buf);
+    if (numeric)
+        q_set_key_mode(batch, Q_KEY_NUMERIC);
+
+    char *line = NULL;
+    size_t cap = 0, used = 0;
+    long len;
+    bool ok = true;
+    while (ok && (len = read_line(fp, &line, &cap)) >= 0) {
+        ok = q_insert_tail(batch, line);
+        used += ELEMENT_COST(len);
+        if (ok && used >= x.batch) {
+            ok = spill(&x, batch);
+            used = 0;
+        }
+    }
+    ok = ok && len == -1;
+    fclose(fp);
+    free(line);
+
+    /* The input is fully read, so the output may replace it */
+    FILE *outfp = ok ? fopen(out, "w") : NULL;
+    if (outfp) {
+        setvbuf(outfp, iobuf, _IOFBF, x.io_buf);
+        if (!x.nr_runs) {
+            q_sort(batch, descend);
+            element_t *e;
+            list_for_each_entry (e, batch, list) {
+                if (!(ok = put_line(outfp, e, numeric)))
+                    break;
+            }
+        } else {
+            ok = (list_empty(batch) || spill(&x, batch)) &&
+                 merge_runs(&x, put_line, outfp);
+        }
+        ok = !fclose(outfp) && ok;
+    } else {
+        ok = false;
+    }
+
+    ext_release(&x);
+    q_free(batch);
+    free(iobuf);
+    return ok;
+}
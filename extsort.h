@@ -0,0 +1,63 @@
+#ifndef LAB0_EXTSORT_H
+#define LAB0_EXTSORT_H
+
+/* External merge sort.
+ *
+ * Strings are sorted in batches which fit a memory budget. Every sorted batch
+ * is spilled to a temporary file as a run of length-prefixed records, and the
+ * runs are then merged k at a time with large sequential reads until a single
+ * ordered stream is left. That stream is inserted back into a queue or written
+ * to an output file.
+ *
+ * The in-memory part reuses the queue: a batch is an ordinary queue sorted by
+ * q_sort(), so the order is the same as q_sort() would produce, including
+ * numeric key mode and stability.
+ *
+ * Temporary files are created in $TMPDIR, or /tmp if unset, and are unlinked
+ * as soon as they are opened.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "queue.h"
+
+/* Smallest budget accepted, enough for a few I/O buffers and a batch */
+#define EXTSORT_MIN_BUDGET (64 * 1024)
+
+/**
+ * q_sort_external() - Sort queue through temporary files
+ * @head: header of queue
+ * @descend: whether or not to sort in descending order
+ * @budget: bytes of elements and I/O buffers held in memory at once, raised
+ *          to EXTSORT_MIN_BUDGET if lower
+ *
+ * Elements are freed as their batch is spilled and allocated again while the
+ * runs are merged back, so the sort needs allocation unlike q_sort(). If the
+ * whole queue fits in @budget, it is sorted in memory without any file.
+ *
+ * Return: true for success. On I/O or allocation failure the queue holds the
+ * elements restored so far, in order, and false is returned.
+ */
+bool q_sort_external(struct list_head *head, bool descend, size_t budget);
+
+/**
+ * extsort_file() - Sort the lines of a file into another file
+ * @in: path of the input, one string per line
+ * @out: path of the output, may be the same as @in
+ * @descend: whether or not to sort in descending order
+ * @numeric: order lines by their numeric key like Q_KEY_NUMERIC queues
+ * @budget: bytes held in memory at once, raised to EXTSORT_MIN_BUDGET if lower
+ *
+ * A missing newline after the last line is accepted, and every line of the
+ * output is terminated.
+ *
+ * Return: true for success, false on I/O or allocation failure
+ */
+bool extsort_file(const char *in,
+                  const char *out,
+                  bool descend,
+                  bool numeric,
+                  size_t budget);
+
+#endif /* LAB0_EXTSORT_H */
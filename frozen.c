@@ -0,0 +1,299 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frozen.h"
+#include "simd_mismatch.h"
+
+/* The buffer holds, for every block, its first string with its terminator,
+ * then for each following string the length of the prefix shared with the
+ * string before it and the length of the rest as LEB128 varints, then the
+ * rest itself. Lengths below 128 take a single byte.
+ */
+struct q_frozen {
+    uint8_t *data;
+    size_t bytes;   /* size of data */
+    size_t *blocks; /* offset of the first string of every block */
+    size_t nblocks;
+    size_t count;
+    size_t max_len;
+    size_t list_bytes;
+    char *scratch; /* string rebuilt while searching */
+    q_key_mode_t mode;
+    bool descend;
+};
+
+/* Write v at p unless p is NULL, return the number of bytes it takes */
+static size_t put_varint(uint8_t *p, uint64_t v)
+{
+    size_t n = 1;
+    for (; v >= 0x80; v >>= 7, n++) {
+        if (p)
+            *p++ = (uint8_t) v | 0x80;
+    }
+    if (p)
+        *p = (uint8_t) v;
+    return n;
+}
+
+static uint64_t get_varint(const uint8_t **p)
+{
+    uint64_t v = 0;
+    for (int shift = 0;; shift += 7) {
+        uint8_t b = *(*p)++;
+        v |= (uint64_t) (b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return v;
+    }
+}
+
+/* Encode the string of @e after @prev, or whole if @prev is NULL, at @p
+ * unless it is NULL. Return the number of bytes it takes.
+ */
+static size_t encode(uint8_t *p, const element_t *e, const element_t *prev)
+{
+    if (!prev) {
+        if (p)
+            memcpy(p, e->value, e->len + 1);
+        return e->len + 1;
+    }
+    size_t n = e->len < prev->len ? e->len : prev->len;
+    size_t shared = simd_mismatch(e->value, prev->value, n);
+    size_t rest = e->len - shared;
+    size_t size = put_varint(p, shared);
+    size += put_varint(p ? p + size : NULL, rest);
+    if (p)
+        memcpy(p + size, e->value + shared, rest);
+    return size + rest;
+}
+
+static void iter_setup(q_frozen_iter_t *it,
+                       const q_frozen_t *frozen,
+                       size_t index,
+                       char *buf)
+{
+    it->frozen = frozen;
+    it->value = buf;
+    it->len = 0;
+    if (index >= frozen->count) {
+        it->index = frozen->count;
+        return;
+    }
+    /* Strings can only be rebuilt from the start of their block */
+    size_t block = index / FROZEN_BLOCK;
+    it->index = block * FROZEN_BLOCK;
+    it->pos = frozen->blocks[block];
+    while (it->index < index)
+        q_frozen_next(it);
+}
+
+/* Move the strings of a sorted queue into front-coded storage */
+q_frozen_t *q_freeze(struct list_head *head, bool descend)
+{
+    if (!head)
+        return NULL;
+    bool numeric = q_key_mode(head) == Q_KEY_NUMERIC;
+    q_cmp_func_t cmp = numeric ? q_cmp_numeric : q_cmp_string;
+
+    /* Check the order and size everything before touching the queue */
+    size_t count = 0, bytes = 0, max_len = 0, list_bytes = 0;
+    element_t *ele, *prev = NULL;
+    list_for_each_entry (ele, head, list) {
+        if (prev) {
+            int c = cmp(NULL, prev, ele);
+            if (descend ? c < 0 : c > 0)
+                return NULL;
+        }
+        bytes += encode(NULL, ele, count % FROZEN_BLOCK ? prev : NULL);
+        if (ele->len > max_len)
+            max_len = ele->len;
+        list_bytes += sizeof(element_t) + ele->len + 1;
+        prev = ele;
+        count++;
+    }
+
+    q_frozen_t *frozen = malloc(sizeof(q_frozen_t));
+    if (!frozen)
+        return NULL;
+    frozen->nblocks = (count + FROZEN_BLOCK - 1) / FROZEN_BLOCK;
+    /* Keep the allocations non-empty for an empty queue */
+    frozen->data = malloc(bytes ? bytes : 1);
+    frozen->blocks =
+        malloc((frozen->nblocks ? frozen->nblocks : 1) * sizeof(size_t));
+    frozen->scratch = malloc(max_len + 1);
+    if (!frozen->data || !frozen->blocks || !frozen->scratch) {
+        free(frozen->data);
+        free(frozen->blocks);
+        free(frozen->scratch);
+        free(frozen);
+        return NULL;
+    }
+    frozen->bytes = bytes;
+    frozen->count = count;
+    frozen->max_len = max_len;
+    frozen->list_bytes = list_bytes;
+    frozen->mode = q_key_mode(head);
+    frozen->descend = descend;
+
+    size_t i = 0, pos = 0;
+    prev = NULL;
+    list_for_each_entry (ele, head, list) {
+        if (i % FROZEN_BLOCK == 0)
+            frozen->blocks[i / FROZEN_BLOCK] = pos;
+        pos += encode(frozen->data + pos, ele, i % FROZEN_BLOCK ? prev : NULL);
+        prev = ele;
+        i++;
+    }
+
+    /* Removing keeps the index and filter of the queue up to date */
+    while ((ele = q_remove_head(head, NULL, 0)))
+        q_release_element(ele);
+    return frozen;
+}
+
+/* Move the strings of a frozen queue back into a queue */
+bool q_thaw(q_frozen_t *frozen, struct list_head *head)
+{
+    if (!frozen || !head)
+        return false;
+    q_frozen_iter_t it;
+    iter_setup(&it, frozen, 0, frozen->scratch);
+    const char *s;
+    size_t n = 0;
+    while ((s = q_frozen_next(&it))) {
+        if (!q_insert_tail(head, (char *) s)) {
+            /* Leave the queue as it was */
+            while (n--)
+                q_release_element(q_remove_tail(head, NULL, 0));
+            return false;
+        }
+        n++;
+    }
+    q_frozen_free(frozen);
+    return true;
+}
+
+/* Free a frozen queue */
+void q_frozen_free(q_frozen_t *frozen)
+{
+    if (!frozen)
+        return;
+    free(frozen->data);
+    free(frozen->blocks);
+    free(frozen->scratch);
+    free(frozen);
+}
+
+/* Report the memory held by a frozen queue */
+void q_frozen_stats(const q_frozen_t *frozen, q_frozen_stats_t *stats)
+{
+    stats->count = frozen->count;
+    stats->bytes = sizeof(q_frozen_t) + frozen->bytes +
+                   frozen->nblocks * sizeof(size_t) + frozen->max_len + 1;
+    stats->list_bytes = frozen->list_bytes;
+    stats->max_len = frozen->max_len;
+}
+
+/* Value searched for, with its key parsed once */
+typedef struct {
+    const char *s;
+    int64_t key;
+} probe_t;
+
+/* Is string a ordered strictly before the probe? */
+static bool before(const q_frozen_t *frozen, const char *a, const probe_t *p)
+{
+    int c;
+    if (frozen->mode == Q_KEY_NUMERIC) {
+        int64_t k = strtoll(a, NULL, 10);
+        c = (k > p->key) - (k < p->key);
+    } else {
+        c = strcmp(a, p->s);
+    }
+    return frozen->descend ? c > 0 : c < 0;
+}
+
+/* Search a frozen queue by bisection */
+bool q_frozen_find(const q_frozen_t *frozen, const char *s, size_t *index)
+{
+    probe_t p = {.s = s, .key = strtoll(s, NULL, 10)};
+
+    /* Find the first block whose first string is not before s */
+    size_t lo = 0, hi = frozen->nblocks;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (before(frozen, (const char *) frozen->data + frozen->blocks[mid],
+                   &p))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    /* The answer is in the block before it, or is its first string */
+    size_t idx = lo * FROZEN_BLOCK;
+    const char *at = NULL;
+    if (lo > 0) {
+        q_frozen_iter_t it;
+        idx = (lo - 1) * FROZEN_BLOCK;
+        iter_setup(&it, frozen, idx, frozen->scratch);
+        for (; idx < lo * FROZEN_BLOCK; idx++) {
+            at = q_frozen_next(&it);
+            if (!at || !before(frozen, at, &p))
+                break;
+            at = NULL;
+        }
+    }
+    if (!at && idx < frozen->count)
+        at = (const char *) frozen->data + frozen->blocks[idx / FROZEN_BLOCK];
+    if (index)
+        *index = idx;
+    /* at is not before s, it is s unless it goes after it */
+    if (!at)
+        return false;
+    if (frozen->mode == Q_KEY_NUMERIC)
+        return strtoll(at, NULL, 10) == p.key;
+    return !strcmp(at, s);
+}
+
+/* Start iterating over a frozen queue */
+bool q_frozen_iter_init(q_frozen_iter_t *it,
+                        const q_frozen_t *frozen,
+                        size_t index)
+{
+    char *buf = malloc(frozen->max_len + 1);
+    if (!buf)
+        return false;
+    iter_setup(it, frozen, index, buf);
+    return true;
+}
+
+/* Get the next string of an iteration */
+const char *q_frozen_next(q_frozen_iter_t *it)
+{
+    const q_frozen_t *frozen = it->frozen;
+    if (it->index >= frozen->count)
+        return NULL;
+    const uint8_t *p = frozen->data + it->pos;
+    if (it->index % FROZEN_BLOCK == 0) {
+        it->len = strlen((const char *) p);
+        memcpy(it->value, p, it->len + 1);
+        p += it->len + 1;
+    } else {
+        size_t shared = get_varint(&p);
+        size_t rest = get_varint(&p);
+        memcpy(it->value + shared, p, rest);
+        p += rest;
+        it->len = shared + rest;
+        it->value[it->len] = '\0';
+    }
+    it->pos = p - frozen->data;
+    it->index++;
+    return it->value;
+}
+
+/* Release an iterator */
+void q_frozen_iter_end(q_frozen_iter_t *it)
+{
+    free(it->value);
+    it->value = NULL;
+}
@@ -0,0 +1,139 @@
+#ifndef LAB0_FROZEN_H
+#define LAB0_FROZEN_H
+
+/* Front-coded storage of sorted queues.
+ *
+ * Once sorted, neighbouring strings tend to share long prefixes. Freezing a
+ * sorted queue moves its strings into a single read-only buffer of blocks of
+ * FROZEN_BLOCK strings. The first string of a block is stored whole, so that
+ * blocks can be searched by bisection. Each following one only stores the
+ * length of the prefix it shares with its predecessor and the rest of its
+ * bytes. The element_t, list links and allocation of every string are gone
+ * as well, which is most of the saving for short strings.
+ *
+ * A frozen queue can be searched and iterated in order, and thawed back into
+ * an ordinary queue.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "queue.h"
+
+/* Strings per block: larger blocks compress better but search slower */
+#define FROZEN_BLOCK 16
+
+typedef struct q_frozen q_frozen_t;
+
+/**
+ * q_frozen_stats_t - Memory held by a frozen queue
+ * @count: number of strings
+ * @bytes: memory held by the frozen queue, buffer and block offsets
+ * @list_bytes: memory the strings took as queue elements, counting each
+ *              element_t and string but no allocator overhead
+ * @max_len: length of the longest string
+ */
+typedef struct {
+    size_t count;
+    size_t bytes;
+    size_t list_bytes;
+    size_t max_len;
+} q_frozen_stats_t;
+
+/**
+ * q_frozen_iter_t - Position in a frozen queue
+ * @frozen: frozen queue walked through
+ * @index: position of the next string
+ * @pos: offset of the next string in the buffer
+ * @value: last string returned, rebuilt in place from its shared prefix
+ * @len: length of @value
+ */
+typedef struct {
+    const q_frozen_t *frozen;
+    size_t index;
+    size_t pos;
+    char *value;
+    size_t len;
+} q_frozen_iter_t;
+
+/**
+ * q_freeze() - Move the strings of a sorted queue into front-coded storage
+ * @head: header of queue, sorted by q_sort() with the same @descend
+ * @descend: whether the queue is in descending order
+ *
+ * The strings are ordered and searched according to the key mode of @head.
+ * On success @head is left empty, but keeps its key mode, index and filter
+ * settings.
+ *
+ * Return: the frozen queue, NULL if @head is NULL, not sorted or allocation
+ * failed, in which case @head is unchanged
+ */
+q_frozen_t *q_freeze(struct list_head *head, bool descend);
+
+/**
+ * q_thaw() - Move the strings of a frozen queue back into a queue
+ * @frozen: frozen queue, freed on success
+ * @head: header of queue receiving the strings at its tail, normally the empty
+ *        queue @frozen was made from
+ *
+ * Return: true for success. False if allocation failed, in which case @head
+ * is unchanged and @frozen is kept.
+ */
+bool q_thaw(q_frozen_t *frozen, struct list_head *head);
+
+/**
+ * q_frozen_free() - Free a frozen queue, no effect if NULL
+ * @frozen: frozen queue
+ */
+void q_frozen_free(q_frozen_t *frozen);
+
+/**
+ * q_frozen_stats() - Report the memory held by a frozen queue
+ * @frozen: frozen queue
+ * @stats: filled in with the sizes
+ */
+void q_frozen_stats(const q_frozen_t *frozen, q_frozen_stats_t *stats);
+
+/**
+ * q_frozen_find() - Search a frozen queue by bisection
+ * @frozen: frozen queue
+ * @s: value to look for, compared according to the key mode it was frozen
+ *     with
+ * @index: set to the position of the first string not ordered before @s,
+ *         which is the number of strings if there is none
+ *
+ * Takes O(log(n / FROZEN_BLOCK) + FROZEN_BLOCK) comparisons. Strings are
+ * rebuilt in a buffer of @frozen, so searches of the same frozen queue must
+ * not run concurrently.
+ *
+ * Return: true if the string at @index equals @s
+ */
+bool q_frozen_find(const q_frozen_t *frozen, const char *s, size_t *index);
+
+/**
+ * q_frozen_iter_init() - Start iterating over a frozen queue
+ * @it: iterator to set up
+ * @frozen: frozen queue
+ * @index: position of the first string to return, as from q_frozen_find()
+ *
+ * Return: true for success, false if allocation failed
+ */
+bool q_frozen_iter_init(q_frozen_iter_t *it,
+                        const q_frozen_t *frozen,
+                        size_t index);
+
+/**
+ * q_frozen_next() - Get the next string of an iteration
+ * @it: iterator
+ *
+ * Return: the string, valid until the next call, NULL past the last one
+ */
+const char *q_frozen_next(q_frozen_iter_t *it);
+
+/**
+ * q_frozen_iter_end() - Release an iterator
+ * @it: iterator
+ */
+void q_frozen_iter_end(q_frozen_iter_t *it);
+
+#endif /* LAB0_FROZEN_H */
@@ -1,14 +1,27 @@
 /* Test support code */
 
+#include <execinfo.h>
+#include <pthread.h>
 #include <setjmp.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "report.h"
 
+#if defined(__APPLE__)
+#include <malloc/malloc.h>
+#define usable_size malloc_size
+#else
+#include <malloc.h>
+#define usable_size malloc_usable_size
+#endif
+
 /* Our program needs to use regular malloc/free */
 #define INTERNAL 1
 #include "harness.h"
@@ -24,75 +37,343 @@
 /* Value at end of every block */
 #define MAGICFOOTER 0xbeefdead
 
+/* Value at start of every block left out of the sample, which has no footer
+ * and is only checked by its header
+ */
+#define MAGICFAST 0xfeedface
+
 /* Byte to fill newly malloced space with */
 #define FILLCHAR 0x55
 
 /* Data structures used by our code */
 
-/* Represent allocated blocks as doubly-linked list, with
- * next and prev pointers at beginning
- */
+/* Header placed before every allocated block */
 typedef struct __block_element {
-    struct __block_element *next, *prev;
     size_t payload_size;
-    size_t magic_header; /* Marker to see if block seems legitimate */
+    uint32_t site;         /* Allocation site, 0 if it could not be recorded */
+    uint32_t magic_header; /* Marker to see if block seems legitimate */
     unsigned char payload[0];
     /* Also place magic number at tail of every block */
 } block_element_t;
 
-static block_element_t *allocated = NULL;
-static size_t allocated_count = 0;
+/* Allocated blocks are tracked in open-addressing hash sets keyed by their
+ * address, with linear probing and deletion by backward shifting, so that
+ * checking a block on free takes O(1) time however many blocks are live.
+ */
+#define LIVE_MIN_SLOTS 1024
+
+typedef struct {
+    block_element_t **slots; /* NULL marks an empty slot */
+    size_t mask;             /* number of slots minus one */
+    size_t count;
+} block_set_t;
+
+/* Blocks are spread by address over shards, each with its own set and lock,
+ * so that threads allocating from different malloc arenas rarely contend.
+ */
+#define ALLOC_SHARDS 16
+
+typedef struct {
+    pthread_mutex_t lock;
+    block_set_t live;
+} __attribute__((aligned(64))) shard_t;
+
+static shard_t shards[ALLOC_SHARDS] = {
+    [0 ... ALLOC_SHARDS - 1] = {.lock = PTHREAD_MUTEX_INITIALIZER},
+};
+
+/* Allocation sites, numbered from 1 and never freed, found by their frames
+ * in an open-addressing hash table of their numbers guarded by site_lock.
+ * Sites are stored in chunks which never move, so that they can be read
+ * without the lock.  They are counted by each thread apart, like the profile.
+ */
+#define SITE_CHUNK 1024
+#define SITE_CHUNKS 1024
+
+static struct {
+    uint32_t *slots; /* 0 marks an empty slot */
+    size_t mask;
+    alloc_site_t *chunks[SITE_CHUNKS];
+    uint32_t count;
+} sites;
+
+static pthread_mutex_t site_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Sites each thread allocated from lately, looked up without the lock */
+#define SITE_CACHE 64
+
+static __thread struct {
+    uint64_t hash;
+    uint32_t id;
+} site_cache[SITE_CACHE];
+
+/* Allocation profile.  Each thread counts its own allocations and frees in a
+ * record only it writes and others read, summed when reported: a block
+ * allocated by one thread and freed by another leaves a live count wrapped
+ * below zero in the second, which the sum corrects.  Live totals and peaks
+ * are shared and updated atomically.
+ */
+typedef struct {
+    size_t allocs, bytes, live_blocks, live_bytes;
+} site_counts_t;
+
+typedef struct __thread_profile {
+    alloc_stats_t stats; /* live and peak counts unused */
+    site_counts_t *sites[SITE_CHUNKS]; /* counts by site, as sites.chunks */
+    struct __thread_profile *next;
+} thread_profile_t;
+
+static thread_profile_t *profiles = NULL;
+static pthread_mutex_t profiles_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread thread_profile_t *local_profile = NULL;
+
+static struct {
+    size_t live_blocks, live_bytes;
+    size_t peak_blocks, peak_bytes, mark_peak_bytes;
+} totals;
+
+/* Add n to a counter of the calling thread, which other threads may read */
+#define BUMP(counter, n) \
+    __atomic_store_n(&(counter), (counter) + (n), __ATOMIC_RELAXED)
+
+static int site_depth = 1;
 
 /* Percent probability of malloc failure */
 int fail_probability = 0;
 
-static bool cautious_mode = true;
-static bool noallocate_mode = false;
+/* Modes apply to the thread setting them: the reclaimer is not restricted by
+ * the mode of the command being tested, and runs without cautious mode.
+ */
+static __thread bool cautious_mode = true;
+static __thread bool noallocate_mode = false;
 static bool error_occurred = false;
 static char *error_message = "";
 
-static int time_limit = 1;
+/* Time limit of protected regions, in microseconds */
+static long time_limit = 1000000;
+static bool timeouts_disabled = false;
+
+/* One block in sample_rate is checked fully, from its own random stream in
+ * every thread
+ */
+static int sample_rate = 1;
+static __thread uint64_t sample_state = 0x9e3779b97f4a7c15ULL;
+
+/* Deferred freeing: work handed to the reclaimer thread */
+typedef struct __deferred {
+    void (*fn)(void *arg);
+    void *arg;
+    struct __deferred *next;
+} deferred_t;
+
+static bool defer_mode = false;
+static bool reclaimer_started = false;
+static bool reclaimer_busy = false;
+static pthread_t reclaimer;
+static pthread_mutex_t defer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t defer_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t defer_idle = PTHREAD_COND_INITIALIZER;
+static deferred_t *defer_head = NULL, **defer_tail = &defer_head;
+static __thread bool in_reclaimer = false;
+
+/* Throughput of the reclaimer: blocks are counted atomically, time is
+ * guarded by defer_lock
+ */
+static size_t reclaimed_blocks = 0;
+static double reclaim_seconds = 0;
 
 /* Data for managing exceptions */
-static jmp_buf env;
+sigjmp_buf exception_env;
 static volatile sig_atomic_t jmp_ready = false;
 static bool time_limited = false;
 
+/* Timer raising SIGALRM when a protected region runs out of time.  It runs
+ * on CLOCK_MONOTONIC and, unlike alarm(), has sub-second resolution; being
+ * apart from ITIMER_REAL, it also leaves ualarm() of the coroutines alone.
+ */
+#ifndef __APPLE__
+static timer_t limit_timer;
+static bool limit_timer_created = false;
+#endif
+
+/* Time spent in protected regions, and start of the current one */
+static double time_spent = 0;
+static double region_start;
+
+/* Allocator calls in progress in this thread, and whether it allocated since
+ * the last safe point: error_check() between operations, or the start or end
+ * of a region.  A timeout striking in the allocator or before the caller had a
+ * chance to link what it allocated is held back, rather than jumping out with
+ * a lock of the harness or of malloc held, or leaking the blocks.  It is raised
+ * at the next safe point, or reported at the end of the region, and the region
+ * gets one more time limit to get there.  Once that runs out too, the timeout
+ * is raised at once, or as soon as the allocator returns, releasing the block
+ * it was returning.
+ */
+static __thread volatile sig_atomic_t in_allocator = 0;
+static __thread volatile sig_atomic_t unlinked = false;
+static __thread char *volatile held_exception = NULL;
+static __thread volatile sig_atomic_t held_overdue = false;
+
 /* Internal functions */
 
+/* Record an error, which any thread may do */
+static void flag_error()
+{
+    __atomic_store_n(&error_occurred, true, __ATOMIC_RELAXED);
+}
+
 /* Should this allocation fail? */
 static bool fail_allocation()
 {
+    if (!fail_probability)
+        return false;
     double weight = (double) random() / RAND_MAX;
     return (weight < 0.01 * fail_probability);
 }
 
-/* Find header of block, given its payload.
- * Signal error if doesn't seem like legitimate block
+/* Should this block be checked fully? */
+static bool sample_block()
+{
+    if (sample_rate <= 1)
+        return true;
+    /* xorshift64 */
+    sample_state ^= sample_state << 13;
+    sample_state ^= sample_state >> 7;
+    sample_state ^= sample_state << 17;
+    return sample_state % sample_rate == 0;
+}
+
+/* Home slot of a block, blocks being at least 16-byte aligned.
+ * Blocks allocated one after the other tend to sit next to each other, and
+ * keeping them in neighbouring slots keeps the set cache-friendly when a
+ * large queue is built or freed; higher bits are folded in to spread blocks
+ * which are far apart.
+ */
+static size_t live_slot(const block_element_t *b, size_t mask)
+{
+    uintptr_t a = (uintptr_t) b >> 4;
+    return (a ^ a >> 16) & mask;
+}
+
+/* Find the slot holding b, or the empty slot ending its probe sequence */
+static size_t live_find(const block_set_t *set, const block_element_t *b)
+{
+    size_t i = live_slot(b, set->mask);
+    while (set->slots[i] && set->slots[i] != b)
+        i = (i + 1) & set->mask;
+    return i;
+}
+
+/* Grow the set to keep its load factor at most 3/4.
+ * The table only grows: its size follows the peak number of live blocks.
+ */
+static bool live_reserve(block_set_t *set)
+{
+    if (set->slots && (set->count + 1) * 4 <= (set->mask + 1) * 3)
+        return true;
+    size_t size = set->slots ? (set->mask + 1) * 2 : LIVE_MIN_SLOTS;
+    block_element_t **slots = calloc(size, sizeof(block_element_t *));
+    if (!slots)
+        return false;
+    block_set_t grown = {.slots = slots, .mask = size - 1, .count = 0};
+    for (size_t i = 0; set->slots && i <= set->mask; i++) {
+        if (set->slots[i]) {
+            grown.slots[live_find(&grown, set->slots[i])] = set->slots[i];
+            grown.count++;
+        }
+    }
+    free(set->slots);
+    *set = grown;
+    return true;
+}
+
+static bool live_add(block_set_t *set, block_element_t *b)
+{
+    if (!live_reserve(set))
+        return false;
+    set->slots[live_find(set, b)] = b;
+    set->count++;
+    return true;
+}
+
+/* Remove b from the set, return false if it was not there */
+static bool live_del(block_set_t *set, const block_element_t *b)
+{
+    if (!set->count)
+        return false;
+    size_t i = live_find(set, b);
+    if (!set->slots[i])
+        return false;
+    /* Shift back later entries of the cluster which may no longer be
+     * reachable from their home slot once slot i is emptied.
+     */
+    for (size_t j = (i + 1) & set->mask; set->slots[j];
+         j = (j + 1) & set->mask) {
+        size_t home = live_slot(set->slots[j], set->mask);
+        if (((j - home) & set->mask) >= ((j - i) & set->mask)) {
+            set->slots[i] = set->slots[j];
+            i = j;
+        }
+    }
+    set->slots[i] = NULL;
+    set->count--;
+    return true;
+}
+
+/* Shard tracking a block.  Arenas of different threads lie far apart, while
+ * blocks within 64 KiB of each other share a shard.
+ */
+static shard_t *shard_of(const block_element_t *b)
+{
+    uintptr_t a = (uintptr_t) b >> 16;
+    return &shards[(a ^ a >> 4 ^ a >> 8) & (ALLOC_SHARDS - 1)];
+}
+
+/* Start tracking a fully checked block */
+static bool track(block_element_t *b)
+{
+    shard_t *shard = shard_of(b);
+    pthread_mutex_lock(&shard->lock);
+    bool ok = live_add(&shard->live, b);
+    pthread_mutex_unlock(&shard->lock);
+    return ok;
+}
+
+/* Stop tracking a block, return false if it was not tracked */
+static bool untrack(const block_element_t *b)
+{
+    shard_t *shard = shard_of(b);
+    pthread_mutex_lock(&shard->lock);
+    bool ok = live_del(&shard->live, b);
+    pthread_mutex_unlock(&shard->lock);
+    return ok;
+}
+
+/* Find header of block, given its payload, and stop tracking it.
+ * Signal error if doesn't seem like legitimate block.
+ * Return NULL if the block is not allocated, it must then be left alone.
  */
 static block_element_t *find_header(void *p)
 {
     if (!p) {
         report_event(MSG_ERROR, "Attempting to free null block");
-        error_occurred = true;
+        flag_error();
     }
 
     block_element_t *b =
         (block_element_t *) ((size_t) p - sizeof(block_element_t));
-    if (cautious_mode) {
-        /* Make sure this is really an allocated block */
-        block_element_t *ab = allocated;
-        bool found = false;
-        while (ab && !found) {
-            found = ab == b;
-            ab = ab->next;
-        }
-        if (!found) {
+    if (b->magic_header == MAGICFAST)
+        return b;
+    /* Make sure this is really an allocated block */
+    if (!untrack(b)) {
+        if (cautious_mode) {
             report_event(MSG_ERROR,
                          "Attempted to free unallocated block.  Address = %p",
                          p);
-            error_occurred = true;
+            flag_error();
         }
+        return NULL;
     }
 
     if (b->magic_header != MAGICHEADER) {
@@ -100,7 +381,7 @@ static block_element_t *find_header(void *p)
             MSG_ERROR,
             "Attempted to free unallocated or corrupted block.  Address = %p",
             p);
-        error_occurred = true;
+        flag_error();
     }
 
     return b;
@@ -115,9 +396,235 @@ static size_t *find_footer(block_element_t *b)
     return p;
 }
 
+/* Size class of an allocation of size bytes */
+int alloc_class(size_t size)
+{
+    if (size <= 8)
+        return 0;
+    /* Number of bits of size - 1, less the 3 bits of class 0 */
+    int c = 61 - __builtin_clzl(size - 1);
+    return c < ALLOC_CLASSES ? c : ALLOC_CLASSES - 1;
+}
+
+/* Profile of the calling thread, registered on first use */
+static thread_profile_t *my_profile()
+{
+    if (!local_profile) {
+        thread_profile_t *tp = calloc(1, sizeof(thread_profile_t));
+        if (!tp)
+            report_event(MSG_FATAL, "Couldn't allocate any more memory");
+        pthread_mutex_lock(&profiles_lock);
+        // cppcheck-suppress nullPointerRedundantCheck
+        tp->next = profiles;
+        profiles = tp;
+        pthread_mutex_unlock(&profiles_lock);
+        local_profile = tp;
+    }
+    return local_profile;
+}
+
+/* Raise a shared peak to v unless it is higher already */
+static void raise_peak(size_t *peak, size_t v)
+{
+    size_t old = __atomic_load_n(peak, __ATOMIC_RELAXED);
+    while (v > old && !__atomic_compare_exchange_n(peak, &old, v, true,
+                                                   __ATOMIC_RELAXED,
+                                                   __ATOMIC_RELAXED))
+        ;
+}
+
+/* Add to the live bytes, raising the peaks */
+static void add_live_bytes(size_t size)
+{
+    size_t live =
+        __atomic_add_fetch(&totals.live_bytes, size, __ATOMIC_RELAXED);
+    raise_peak(&totals.peak_bytes, live);
+    raise_peak(&totals.mark_peak_bytes, live);
+}
+
+static void profile_alloc(size_t size)
+{
+    alloc_stats_t *p = &my_profile()->stats;
+    int c = alloc_class(size);
+    BUMP(p->allocs, 1);
+    BUMP(p->alloc_bytes, size);
+    BUMP(p->class_allocs[c], 1);
+    BUMP(p->class_live[c], 1);
+    raise_peak(&totals.peak_blocks,
+               __atomic_add_fetch(&totals.live_blocks, 1, __ATOMIC_RELAXED));
+    add_live_bytes(size);
+}
+
+static void profile_resize(size_t old_size, size_t size, bool moved)
+{
+    alloc_stats_t *p = &my_profile()->stats;
+    BUMP(p->reallocs, 1);
+    if (moved)
+        BUMP(p->moves, 1);
+    BUMP(p->class_live[alloc_class(old_size)], -1);
+    BUMP(p->class_live[alloc_class(size)], 1);
+    if (size < old_size) {
+        BUMP(p->free_bytes, old_size - size);
+        __atomic_sub_fetch(&totals.live_bytes, old_size - size,
+                           __ATOMIC_RELAXED);
+        return;
+    }
+    BUMP(p->alloc_bytes, size - old_size);
+    add_live_bytes(size - old_size);
+}
+
+static void profile_free(size_t size)
+{
+    alloc_stats_t *p = &my_profile()->stats;
+    BUMP(p->frees, 1);
+    BUMP(p->free_bytes, size);
+    BUMP(p->class_live[alloc_class(size)], -1);
+    __atomic_sub_fetch(&totals.live_blocks, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&totals.live_bytes, size, __ATOMIC_RELAXED);
+}
+
+/* Record the frames of an allocation made by the caller returning to ret */
+static int site_capture(void **frames, void *ret)
+{
+    int depth = site_depth;
+    if (depth > 1) {
+        /* Skip the frames of the harness, down to the allocating call */
+        void *trace[ALLOC_SITE_DEPTH + 4];
+        int n = backtrace(trace, depth + 4);
+        for (int i = 0; i < n; i++) {
+            if (trace[i] == ret) {
+                depth = n - i < depth ? n - i : depth;
+                memcpy(frames, trace + i, depth * sizeof(void *));
+                return depth;
+            }
+        }
+    }
+    frames[0] = ret;
+    return 1;
+}
+
+static uint64_t site_hash(void *const *frames, int depth)
+{
+    uint64_t h = depth;
+    for (int i = 0; i < depth; i++)
+        h = (h ^ (uintptr_t) frames[i]) * 0x9e3779b97f4a7c15ULL;
+    return h ^ h >> 32;
+}
+
+static alloc_site_t *site_at(uint32_t id)
+{
+    return &sites.chunks[(id - 1) / SITE_CHUNK][(id - 1) % SITE_CHUNK];
+}
+
+static bool site_is(const alloc_site_t *site, void *const *frames, int depth)
+{
+    return site->depth == depth &&
+           !memcmp(site->frames, frames, depth * sizeof(void *));
+}
+
+/* Make room for one more site, with site_lock held */
+static bool site_reserve()
+{
+    if (sites.count == SITE_CHUNK * SITE_CHUNKS)
+        return false;
+    if (sites.count % SITE_CHUNK == 0) {
+        alloc_site_t *chunk = calloc(SITE_CHUNK, sizeof(alloc_site_t));
+        if (!chunk)
+            return false;
+        sites.chunks[sites.count / SITE_CHUNK] = chunk;
+    }
+    if (sites.slots && (sites.count + 1) * 4 <= (sites.mask + 1) * 3)
+        return true;
+    size_t size = sites.slots ? (sites.mask + 1) * 2 : 64;
+    uint32_t *slots = calloc(size, sizeof(uint32_t));
+    if (!slots)
+        return false;
+    for (uint32_t n = 1; n <= sites.count; n++) {
+        alloc_site_t *site = site_at(n);
+        size_t i = site_hash(site->frames, site->depth) & (size - 1);
+        while (slots[i])
+            i = (i + 1) & (size - 1);
+        slots[i] = n;
+    }
+    free(sites.slots);
+    sites.slots = slots;
+    sites.mask = size - 1;
+    return true;
+}
+
+/* Find or add the site with the given frames and hash, with site_lock held.
+ * Return its number, 0 if a new site could not be allocated.
+ */
+static uint32_t site_get(void *const *frames, int depth, uint64_t hash)
+{
+    if (sites.slots) {
+        size_t i = hash & sites.mask;
+        for (; sites.slots[i]; i = (i + 1) & sites.mask) {
+            if (site_is(site_at(sites.slots[i]), frames, depth))
+                return sites.slots[i];
+        }
+    }
+    if (!site_reserve())
+        return 0;
+    alloc_site_t *site = site_at(sites.count + 1);
+    memcpy(site->frames, frames, depth * sizeof(void *));
+    site->depth = depth;
+    size_t i = hash & sites.mask;
+    while (sites.slots[i])
+        i = (i + 1) & sites.mask;
+    sites.slots[i] = ++sites.count;
+    return sites.count;
+}
+
+/* Number of the site with the given frames, 0 if it could not be recorded */
+static uint32_t site_find(void *const *frames, int depth)
+{
+    uint64_t hash = site_hash(frames, depth);
+    int c = hash % SITE_CACHE;
+    uint32_t id = site_cache[c].id;
+    if (id && site_cache[c].hash == hash && site_is(site_at(id), frames, depth))
+        return id;
+
+    pthread_mutex_lock(&site_lock);
+    id = site_get(frames, depth, hash);
+    pthread_mutex_unlock(&site_lock);
+    if (id) {
+        site_cache[c].hash = hash;
+        site_cache[c].id = id;
+    }
+    return id;
+}
+
+/* Count size bytes more or, wrapping around, fewer live in a site */
+static void site_count(uint32_t id, size_t blocks, size_t size, bool grown)
+{
+    if (!id)
+        return;
+    thread_profile_t *tp = my_profile();
+    site_counts_t *chunk = tp->sites[(id - 1) / SITE_CHUNK];
+    if (!chunk) {
+        chunk = calloc(SITE_CHUNK, sizeof(site_counts_t));
+        if (!chunk) {
+            report_event(MSG_FATAL, "Couldn't allocate any more memory");
+            return;
+        }
+        /* Readers must see the chunk cleared */
+        __atomic_store_n(&tp->sites[(id - 1) / SITE_CHUNK], chunk,
+                         __ATOMIC_RELEASE);
+    }
+    site_counts_t *c = &chunk[(id - 1) % SITE_CHUNK];
+    if (grown) {
+        BUMP(c->allocs, blocks);
+        BUMP(c->bytes, size);
+    }
+    BUMP(c->live_blocks, blocks);
+    BUMP(c->live_bytes, size);
+}
+
 /* Implementation of application functions */
 
-void *test_malloc(size_t size)
+/* Allocate a block for the caller returning to ret */
+static void *alloc_block(size_t size, void *ret)
 {
     if (noallocate_mode) {
         report_event(MSG_FATAL, "Calls to malloc disallowed");
@@ -126,49 +633,45 @@ void *test_malloc(size_t size)
 
     if (fail_allocation()) {
         report_event(MSG_WARN, "Malloc returning NULL");
+        BUMP(my_profile()->stats.failed, 1);
         return NULL;
     }
 
-    block_element_t *new_block =
-        malloc(size + sizeof(block_element_t) + sizeof(size_t));
+    bool full = sample_block();
+    block_element_t *new_block = malloc(size + sizeof(block_element_t) +
+                                        (full ? sizeof(size_t) : 0));
     if (!new_block) {
         report_event(MSG_FATAL, "Couldn't allocate any more memory");
-        error_occurred = true;
+        flag_error();
     }
 
     // cppcheck-suppress nullPointerRedundantCheck
-    new_block->magic_header = MAGICHEADER;
+    new_block->magic_header = full ? MAGICHEADER : MAGICFAST;
     // cppcheck-suppress nullPointerRedundantCheck
     new_block->payload_size = size;
-    *find_footer(new_block) = MAGICFOOTER;
     void *p = (void *) &new_block->payload;
-    memset(p, FILLCHAR, size);
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->next = allocated;
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->prev = NULL;
+    if (full) {
+        *find_footer(new_block) = MAGICFOOTER;
+        memset(p, FILLCHAR, size);
+    }
 
-    if (allocated)
-        allocated->prev = new_block;
-    allocated = new_block;
-    allocated_count++;
+    /* Only fully checked blocks can be told from stray pointers */
+    if (full && !track(new_block)) {
+        report_event(MSG_FATAL, "Couldn't allocate any more memory");
+        flag_error();
+        free(new_block);
+        return NULL;
+    }
 
+    void *frames[ALLOC_SITE_DEPTH];
+    int depth = site_capture(frames, ret);
+    new_block->site = site_find(frames, depth);
+    site_count(new_block->site, 1, size, true);
+    profile_alloc(size);
     return p;
 }
 
-// cppcheck-suppress unusedFunction
-void *test_calloc(size_t nelem, size_t elsize)
-{
-    /* Reference: Malloc tutorial
-     * https://danluu.com/malloc-tutorial/
-     */
-    size_t size = nelem * elsize;  // TODO: check for overflow
-    void *ptr = test_malloc(size);
-    memset(ptr, 0, size);
-    return ptr;
-}
-
-void test_free(void *p)
+static void release_block(void *p)
 {
     if (noallocate_mode) {
         report_event(MSG_FATAL, "Calls to free disallowed");
@@ -179,37 +682,159 @@ void test_free(void *p)
         return;
 
     block_element_t *b = find_header(p);
-    size_t footer = *find_footer(b);
-    if (footer != MAGICFOOTER) {
+    if (!b)
+        return;
+    if (b->magic_header != MAGICFAST) {
+        size_t footer = *find_footer(b);
+        if (footer != MAGICFOOTER) {
+            report_event(MSG_ERROR,
+                         "Corruption detected in block with address %p when "
+                         "attempting to free it",
+                         p);
+            flag_error();
+        }
+        *find_footer(b) = MAGICFREE;
+        memset(p, FILLCHAR, b->payload_size);
+    }
+    b->magic_header = MAGICFREE;
+    site_count(b->site, -1, -b->payload_size, false);
+    profile_free(b->payload_size);
+    if (in_reclaimer)
+        __atomic_add_fetch(&reclaimed_blocks, 1, __ATOMIC_RELAXED);
+
+    free(b);
+}
+
+static void enter_allocator()
+{
+    in_allocator++;
+}
+
+/* Note the block @fresh returned to the caller, if any, and raise a timeout
+ * held back past its extra time limit, releasing @fresh instead
+ */
+static void leave_allocator(void *fresh)
+{
+    if (fresh)
+        unlinked = true;
+    if (!--in_allocator && held_overdue) {
+        if (fresh)
+            release_block(fresh);
+        trigger_exception(held_exception);
+    }
+}
+
+/* Resize a block for the caller returning to ret */
+static void *resize_block(void *p, size_t size, void *ret)
+{
+    if (!p)
+        return alloc_block(size, ret);
+
+    if (noallocate_mode) {
+        report_event(MSG_FATAL, "Calls to realloc disallowed");
+        return NULL;
+    }
+
+    if (!size) {
+        release_block(p);
+        return NULL;
+    }
+
+    if (fail_allocation()) {
+        report_event(MSG_WARN, "Realloc returning NULL");
+        BUMP(my_profile()->stats.failed, 1);
+        return NULL;
+    }
+
+    block_element_t *b = find_header(p);
+    if (!b)
+        return NULL;
+    bool full = b->magic_header != MAGICFAST;
+    if (full && *find_footer(b) != MAGICFOOTER) {
         report_event(MSG_ERROR,
                      "Corruption detected in block with address %p when "
-                     "attempting to free it",
+                     "attempting to resize it",
                      p);
-        error_occurred = true;
+        flag_error();
     }
-    b->magic_header = MAGICFREE;
-    *find_footer(b) = MAGICFREE;
-    memset(p, FILLCHAR, b->payload_size);
-
-    /* Unlink from list */
-    block_element_t *bn = b->next;
-    block_element_t *bp = b->prev;
-    if (bp)
-        bp->next = bn;
-    else
-        allocated = bn;
-    if (bn)
-        bn->prev = bp;
 
-    free(b);
-    allocated_count--;
+    /* Grow in place into the slack malloc left at the end of the block if
+     * there is enough, realloc may still extend or shrink it in place
+     */
+    size_t old_size = b->payload_size;
+    size_t total = size + sizeof(block_element_t) + (full ? sizeof(size_t) : 0);
+    block_element_t *nb = total > usable_size(b) ? realloc(b, total) : b;
+    if (!nb) {
+        /* find_header() stopped tracking the block, which is kept */
+        if (full && !track(b))
+            flag_error();
+        report_event(MSG_FATAL, "Couldn't allocate any more memory");
+        flag_error();
+        return NULL;
+    }
+    nb->payload_size = size;
+    if (full) {
+        if (size > old_size)
+            memset(nb->payload + old_size, FILLCHAR, size - old_size);
+        *find_footer(nb) = MAGICFOOTER;
+        if (!track(nb)) {
+            report_event(MSG_ERROR, "Could not track resized block %p",
+                         nb->payload);
+            flag_error();
+        }
+    }
+    profile_resize(old_size, size, nb != b);
+    site_count(nb->site, 0, size - old_size, size > old_size);
+    return nb->payload;
+}
+
+void *test_malloc(size_t size)
+{
+    enter_allocator();
+    void *p = alloc_block(size, __builtin_return_address(0));
+    leave_allocator(p);
+    return p;
+}
+
+// cppcheck-suppress unusedFunction
+void *test_realloc(void *p, size_t size)
+{
+    enter_allocator();
+    void *q = resize_block(p, size, __builtin_return_address(0));
+    /* A block resized in place is still linked wherever it was */
+    leave_allocator(q != p ? q : NULL);
+    return q;
+}
+
+// cppcheck-suppress unusedFunction
+void *test_calloc(size_t nelem, size_t elsize)
+{
+    /* Reference: Malloc tutorial
+     * https://danluu.com/malloc-tutorial/
+     */
+    size_t size = nelem * elsize;  // TODO: check for overflow
+    enter_allocator();
+    void *ptr = alloc_block(size, __builtin_return_address(0));
+    leave_allocator(ptr);
+    if (ptr)
+        memset(ptr, 0, size);
+    return ptr;
+}
+
+void test_free(void *p)
+{
+    enter_allocator();
+    release_block(p);
+    leave_allocator(NULL);
 }
 
 // cppcheck-suppress unusedFunction
 char *test_strdup(const char *s)
 {
     size_t len = strlen(s) + 1;
-    void *new = test_malloc(len);
+    enter_allocator();
+    void *new = alloc_block(len, __builtin_return_address(0));
+    leave_allocator(new);
     if (!new)
         return NULL;
 
@@ -218,19 +843,236 @@ char *test_strdup(const char *s)
 
 size_t allocation_check()
 {
-    return allocated_count;
+    /* Blocks still queued for the reclaimer are not leaked */
+    reclaim_drain();
+    return __atomic_load_n(&totals.live_blocks, __ATOMIC_RELAXED);
+}
+
+/* Add a counter of a thread to a sum */
+#define SUM(field) \
+    stats->field += __atomic_load_n(&tp->stats.field, __ATOMIC_RELAXED)
+
+void alloc_stats(alloc_stats_t *stats)
+{
+    reclaim_drain();
+    memset(stats, 0, sizeof(alloc_stats_t));
+    pthread_mutex_lock(&profiles_lock);
+    for (thread_profile_t *tp = profiles; tp; tp = tp->next) {
+        SUM(allocs);
+        SUM(frees);
+        SUM(failed);
+        SUM(reallocs);
+        SUM(moves);
+        SUM(alloc_bytes);
+        SUM(free_bytes);
+        for (int i = 0; i < ALLOC_CLASSES; i++) {
+            SUM(class_allocs[i]);
+            SUM(class_live[i]);
+        }
+    }
+    pthread_mutex_unlock(&profiles_lock);
+    stats->live_blocks = __atomic_load_n(&totals.live_blocks, __ATOMIC_RELAXED);
+    stats->live_bytes = __atomic_load_n(&totals.live_bytes, __ATOMIC_RELAXED);
+    stats->peak_blocks = __atomic_load_n(&totals.peak_blocks, __ATOMIC_RELAXED);
+    stats->peak_bytes = __atomic_load_n(&totals.peak_bytes, __ATOMIC_RELAXED);
+    stats->mark_peak_bytes =
+        __atomic_load_n(&totals.mark_peak_bytes, __ATOMIC_RELAXED);
+}
+
+void alloc_stats_mark()
+{
+    __atomic_store_n(&totals.mark_peak_bytes,
+                     __atomic_load_n(&totals.live_bytes, __ATOMIC_RELAXED),
+                     __ATOMIC_RELAXED);
+}
+
+/* Order sites by decreasing live bytes */
+static int cmp_leaked(const void *a, const void *b)
+{
+    const alloc_site_t *sa = a, *sb = b;
+    return (sa->live_bytes < sb->live_bytes) -
+           (sa->live_bytes > sb->live_bytes);
+}
+
+/* Order sites by decreasing allocations */
+static int cmp_allocs(const void *a, const void *b)
+{
+    const alloc_site_t *sa = a, *sb = b;
+    return (sa->allocs < sb->allocs) - (sa->allocs > sb->allocs);
+}
+
+/* Add the counts of all threads for a site to its copy */
+static void site_sum(alloc_site_t *copy, uint32_t id)
+{
+    for (thread_profile_t *tp = profiles; tp; tp = tp->next) {
+        const site_counts_t *chunk = __atomic_load_n(
+            &tp->sites[(id - 1) / SITE_CHUNK], __ATOMIC_ACQUIRE);
+        if (!chunk)
+            continue;
+        const site_counts_t *c = &chunk[(id - 1) % SITE_CHUNK];
+        copy->allocs += __atomic_load_n(&c->allocs, __ATOMIC_RELAXED);
+        copy->bytes += __atomic_load_n(&c->bytes, __ATOMIC_RELAXED);
+        copy->live_blocks += __atomic_load_n(&c->live_blocks, __ATOMIC_RELAXED);
+        copy->live_bytes += __atomic_load_n(&c->live_bytes, __ATOMIC_RELAXED);
+    }
+}
+
+size_t alloc_sites(alloc_site_t *out, size_t max, bool leaked)
+{
+    reclaim_drain();
+    pthread_mutex_lock(&site_lock);
+    alloc_site_t *found = calloc(sites.count + 1, sizeof(alloc_site_t));
+    if (!found) {
+        pthread_mutex_unlock(&site_lock);
+        return 0;
+    }
+    size_t n = 0;
+    pthread_mutex_lock(&profiles_lock);
+    for (uint32_t id = 1; id <= sites.count; id++) {
+        const alloc_site_t *site = site_at(id);
+        alloc_site_t *copy = &found[n];
+        memcpy(copy->frames, site->frames, sizeof(site->frames));
+        copy->depth = site->depth;
+        site_sum(copy, id);
+        if (!leaked || copy->live_blocks)
+            n++;
+        else
+            memset(copy, 0, sizeof(alloc_site_t));
+    }
+    pthread_mutex_unlock(&profiles_lock);
+    pthread_mutex_unlock(&site_lock);
+    qsort(found, n, sizeof(alloc_site_t), leaked ? cmp_leaked : cmp_allocs);
+    for (size_t i = 0; i < n && i < max; i++)
+        out[i] = found[i];
+    free(found);
+    return n;
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *reclaimer_main(void *unused)
+{
+    in_reclaimer = true;
+    cautious_mode = false;
+    pthread_mutex_lock(&defer_lock);
+    for (;;) {
+        while (!defer_head) {
+            reclaimer_busy = false;
+            pthread_cond_broadcast(&defer_idle);
+            pthread_cond_wait(&defer_work, &defer_lock);
+        }
+        deferred_t *job = defer_head;
+        defer_head = job->next;
+        if (!defer_head)
+            defer_tail = &defer_head;
+        reclaimer_busy = true;
+        pthread_mutex_unlock(&defer_lock);
+
+        double start = now();
+        job->fn(job->arg);
+        double elapsed = now() - start;
+        free(job);
+
+        pthread_mutex_lock(&defer_lock);
+        reclaim_seconds += elapsed;
+    }
+    return NULL;
+}
+
+/* Start the reclaimer with every signal blocked, so that alarms and
+ * exceptions are always delivered to the thread running the tested code.
+ */
+static bool reclaimer_start()
+{
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    reclaimer_started =
+        !pthread_create(&reclaimer, NULL, reclaimer_main, NULL) &&
+        !pthread_detach(reclaimer);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return reclaimer_started;
+}
+
+bool test_defer_free(void (*fn)(void *arg), void *arg)
+{
+    if (!defer_mode || noallocate_mode)
+        return false;
+    deferred_t *job = malloc(sizeof(deferred_t));
+    if (!job)
+        return false;
+    job->fn = fn;
+    job->arg = arg;
+    job->next = NULL;
+
+    pthread_mutex_lock(&defer_lock);
+    if (!reclaimer_started && !reclaimer_start()) {
+        pthread_mutex_unlock(&defer_lock);
+        free(job);
+        return false;
+    }
+    *defer_tail = job;
+    defer_tail = &job->next;
+    reclaimer_busy = true;
+    pthread_cond_signal(&defer_work);
+    pthread_mutex_unlock(&defer_lock);
+    return true;
+}
+
+void reclaim_drain()
+{
+    pthread_mutex_lock(&defer_lock);
+    while (reclaimer_busy)
+        pthread_cond_wait(&defer_idle, &defer_lock);
+    pthread_mutex_unlock(&defer_lock);
+}
+
+void reclaim_stats(size_t *blocks, double *seconds)
+{
+    reclaim_drain();
+    pthread_mutex_lock(&defer_lock);
+    *blocks = __atomic_load_n(&reclaimed_blocks, __ATOMIC_RELAXED);
+    *seconds = reclaim_seconds;
+    pthread_mutex_unlock(&defer_lock);
 }
 
 /* Implementation of functions for testing */
 
 /* Set/unset cautious mode.
  * In this mode, makes extra sure any block to be freed is currently allocated.
+ * The check is a lookup in the set of allocated blocks, so it costs nothing
+ * noticeable even for large queues.
  */
 void set_cautious_mode(bool cautious)
 {
     cautious_mode = cautious;
 }
 
+/* Set how many frames identify an allocation site */
+void set_alloc_site_depth(int depth)
+{
+    if (depth < 1)
+        depth = 1;
+    site_depth = depth < ALLOC_SITE_DEPTH ? depth : ALLOC_SITE_DEPTH;
+}
+
+/* Check one block in rate fully, all of them for a rate of 1 or less */
+void set_sample_rate(int rate)
+{
+    sample_rate = rate;
+}
+
+/* Enable/disable deferred freeing */
+void set_deferred_free_mode(bool deferred)
+{
+    defer_mode = deferred;
+}
+
 /* Set/unset restricted allocation mode.
  * In this mode, calls to malloc and free are disallowed.
  */
@@ -242,58 +1084,139 @@ void set_noallocate_mode(bool noallocate)
 /* Return whether any errors have occurred since last time set error limit */
 bool error_check()
 {
-    bool e = error_occurred;
-    error_occurred = false;
-    return e;
+    if (held_exception && jmp_ready)
+        trigger_exception(held_exception);
+    unlinked = false;
+    /* Checked once per operation in bulk commands: only write when set */
+    return __atomic_load_n(&error_occurred, __ATOMIC_RELAXED) &&
+           __atomic_exchange_n(&error_occurred, false, __ATOMIC_RELAXED);
 }
 
-/* Prepare for a risky operation using setjmp.
- * Function returns true for initial return, false for error return
- */
-bool exception_setup(bool limit_time)
-{
-    if (sigsetjmp(env, 1)) {
-        /* Got here from longjmp */
-        jmp_ready = false;
-        if (time_limited) {
-            alarm(0);
-            time_limited = false;
+/* Raise SIGALRM in usecs microseconds, never if usecs is 0 */
+static void arm_timer(long usecs)
+{
+#ifdef __APPLE__
+    /* No POSIX timers: fall back on the interval timer */
+    struct itimerval it = {
+        .it_value = {.tv_sec = usecs / 1000000, .tv_usec = usecs % 1000000},
+    };
+    setitimer(ITIMER_REAL, &it, NULL);
+#else
+    if (!limit_timer_created) {
+        struct sigevent sev = {
+            .sigev_notify = SIGEV_SIGNAL,
+            .sigev_signo = SIGALRM,
+        };
+        if (timer_create(CLOCK_MONOTONIC, &sev, &limit_timer)) {
+            /* Whole seconds are better than no limit */
+            alarm(usecs ? (usecs + 999999) / 1000000 : 0);
+            return;
         }
+        limit_timer_created = true;
+    }
+    struct itimerspec its = {
+        .it_value = {.tv_sec = usecs / 1000000,
+                     .tv_nsec = usecs % 1000000 * 1000},
+    };
+    timer_settime(limit_timer, 0, &its, NULL);
+#endif
+}
 
-        if (error_message)
-            report_event(MSG_ERROR, error_message);
-        error_message = "";
-        return false;
+/* Close a protected region, stopping its timer */
+static void end_region()
+{
+    if (time_limited) {
+        arm_timer(0);
+        time_limited = false;
     }
+    time_spent += now() - region_start;
+    jmp_ready = false;
+}
+
+void set_time_limit(long usecs)
+{
+    time_limit = usecs;
+}
 
-    /* Got here from initial call */
+void disable_timeouts()
+{
+    timeouts_disabled = true;
+}
+
+double time_limit_spent(double *limit)
+{
+    if (limit)
+        *limit = time_limit * 1e-6;
+    return time_spent;
+}
+
+int exception_prepare(bool limit_time)
+{
+    /* Only a timeout jumps back from a signal handler, leaving the signal
+     * blocked.  Without a timer there is no mask to restore, so it is not
+     * saved, which would take a system call.
+     */
+    time_limited = limit_time && time_limit && !timeouts_disabled;
+    return time_limited;
+}
+
+bool exception_enter()
+{
+    held_exception = NULL;
+    held_overdue = false;
+    unlinked = false;
     jmp_ready = true;
-    if (limit_time) {
-        alarm(time_limit);
-        time_limited = true;
-    }
+    region_start = now();
+    if (time_limited)
+        arm_timer(time_limit);
     return true;
 }
 
+void exception_caught()
+{
+    end_region();
+
+    if (error_message)
+        report_event(MSG_ERROR, error_message);
+    error_message = "";
+}
+
 /* Call once past risky code */
 void exception_cancel()
 {
-    if (time_limited) {
-        alarm(0);
-        time_limited = false;
+    if (jmp_ready) {
+        end_region();
+        /* Past the risky code, a held timeout is reported, not jumped to */
+        if (held_exception) {
+            flag_error();
+            report_event(MSG_ERROR, held_exception);
+        }
     }
-
-    jmp_ready = false;
+    held_exception = NULL;
+    held_overdue = false;
     error_message = "";
 }
 
 /* Use longjmp to return to most recent exception setup */
 void trigger_exception(char *msg)
 {
-    error_occurred = true;
+    if (held_exception) {
+        /* Out of extra time as well */
+        held_overdue = true;
+        if (in_allocator)
+            return;
+    } else if (in_allocator || unlinked) {
+        held_exception = msg;
+        if (time_limited)
+            arm_timer(time_limit);
+        return;
+    }
+    held_exception = NULL;
+    held_overdue = false;
+    flag_error();
     error_message = msg;
     if (jmp_ready)
-        siglongjmp(env, 1);
+        siglongjmp(exception_env, 1);
     else
         exit(1);
 }
@@ -14,13 +14,106 @@ void *test_malloc(size_t size);
 void *test_calloc(size_t nmemb, size_t size);
 void test_free(void *p);
 char *test_strdup(const char *s);
-/* FIXME: provide test_realloc as well */
+
+/* Resize a block like realloc, growing it in place when malloc left enough
+ * room after it.  The block keeps its allocation site, checks and sampling.
+ */
+void *test_realloc(void *p, size_t size);
+
+/* Hand fn(arg) over to the reclaimer thread when deferred freeing is enabled,
+ * so that releasing a large structure does not hold up the caller. fn must
+ * only free memory nothing else refers to anymore.
+ * Return false, leaving the work to the caller, when freeing is not deferred.
+ */
+bool test_defer_free(void (*fn)(void *arg), void *arg);
 
 #ifdef INTERNAL
 
-/* Report number of allocated blocks */
+/* Report number of allocated blocks, once deferred frees are done.
+ * Allocation and freeing are thread-safe, the counts adding up all threads.
+ */
 size_t allocation_check();
 
+/* Allocations are counted by size class: class 0 holds requests of up to 8
+ * bytes, class i those of up to 8 << i bytes and the last class all larger
+ * ones.
+ */
+#define ALLOC_CLASSES 16
+
+/* Counters kept by test_malloc(), test_realloc() and test_free(), all since
+ * program start but for @mark_peak_bytes. Sizes are the ones requested,
+ * without the header and footer added by the harness; resizing a block
+ * counts the change in size as bytes allocated or freed.
+ */
+typedef struct {
+    size_t allocs;          /* successful allocations */
+    size_t frees;           /* blocks freed */
+    size_t failed;          /* allocations failed on purpose */
+    size_t reallocs;        /* blocks resized */
+    size_t moves;           /* blocks moved when resized */
+    size_t alloc_bytes;     /* bytes allocated */
+    size_t free_bytes;      /* bytes freed */
+    size_t live_blocks;     /* blocks allocated and not yet freed */
+    size_t live_bytes;      /* bytes held by them */
+    size_t peak_blocks;     /* most blocks live at once */
+    size_t peak_bytes;      /* most bytes live at once */
+    size_t mark_peak_bytes; /* most bytes live since alloc_stats_mark() */
+    size_t class_allocs[ALLOC_CLASSES];
+    size_t class_live[ALLOC_CLASSES];
+} alloc_stats_t;
+
+/* Copy the allocation counters, once deferred frees are done */
+void alloc_stats(alloc_stats_t *stats);
+
+/* Restart the peak reported as mark_peak_bytes from the current live bytes */
+void alloc_stats_mark();
+
+/* Size class of an allocation of size bytes */
+int alloc_class(size_t size);
+
+/* Most frames recorded for an allocation site */
+#define ALLOC_SITE_DEPTH 8
+
+/* Allocations made from one call site, told apart by the return address of
+ * the allocating call and, with a site depth above one, those of its
+ * callers.
+ */
+typedef struct {
+    void *frames[ALLOC_SITE_DEPTH];
+    int depth;
+    size_t allocs;      /* allocations made */
+    size_t bytes;       /* bytes allocated */
+    size_t live_blocks; /* blocks not yet freed */
+    size_t live_bytes;  /* bytes held by them */
+} alloc_site_t;
+
+/*
+ * Set how many frames identify an allocation site, from 1 for the caller of
+ * malloc only to ALLOC_SITE_DEPTH.  Deeper sites take a backtrace on every
+ * allocation.
+ */
+void set_alloc_site_depth(int depth);
+
+/*
+ * Copy up to max allocation sites into sites, once deferred frees are done.
+ * With leaked set, only sites holding live blocks are reported, most bytes
+ * first, otherwise all sites are, most allocations first.
+ * Return the number of sites there are to report, which may exceed max.
+ */
+size_t alloc_sites(alloc_site_t *sites, size_t max, bool leaked);
+
+/*
+ * Enable/disable deferred freeing.
+ * In this mode, test_defer_free() passes work to a background reclaimer.
+ */
+void set_deferred_free_mode(bool deferred);
+
+/* Wait until the reclaimer has finished all deferred work */
+void reclaim_drain();
+
+/* Report the blocks freed by the reclaimer and the time it spent on them */
+void reclaim_stats(size_t *blocks, double *seconds);
+
 /* Probability of malloc failing, expressed as percent */
 extern int fail_probability;
 
@@ -30,6 +123,16 @@ extern int fail_probability;
  */
 void set_cautious_mode(bool cautious);
 
+/*
+ * Set the sampling rate of checks.
+ * One block in rate, picked at random, is filled with a pattern when
+ * allocated and freed, gets a footer and is tracked so that cautious mode
+ * can vouch for it.  The others only get a header, checked when they are
+ * freed, and cost about as much as plain malloc and free.  With a rate of 1
+ * or less, every block is checked.
+ */
+void set_sample_rate(int rate);
+
 /*
  * Set/unset restricted allocation mode.
  * In this mode, calls to malloc and free are disallowed.
@@ -39,10 +142,50 @@ void set_noallocate_mode(bool noallocate);
 /* Return whether any errors have occurred since last time checked */
 bool error_check();
 
-/* Prepare for a risky operation using setjmp.
- * Function returns true for initial return, false for error return
+/* Limit each protected region to usecs microseconds, one second at start.
+ * With no limit (0), regions are entered without any system call.  A region
+ * which allocates may take up to twice as long, so that its timeout is raised
+ * between operations rather than before it linked what it allocated.
+ */
+void set_time_limit(long usecs);
+
+/* Never limit protected regions, whatever the time limit, for runs too slow
+ * to be timed such as under Valgrind
+ */
+void disable_timeouts();
+
+/* Return the seconds spent in protected regions since start, and set limit
+ * to the time limit of each region in seconds unless it is NULL
+ */
+double time_limit_spent(double *limit);
+
+/* Run a risky operation in a protected region using setjmp, as in
+ *
+ *     exception_try(limit_time) {
+ *         risky code
+ *     }
+ *     exception_cancel();
+ *
+ * The statement following it is skipped on error return.  It must be a
+ * macro: longjmp can only return to a frame which is still live, that of the
+ * caller, which may run a whole batch of operations in one region.  For setjmp
+ * to be used as C allows, it is the entire controlling expression of an if,
+ * so the macro is a statement rather than an expression: a condition on the
+ * region goes in an enclosing if, and an else after it needs braces.  Locals
+ * assigned in the region and read once it is over must be volatile.
+ */
+#define exception_try(limit_time)                                \
+    if (sigsetjmp(exception_env, exception_prepare(limit_time))) \
+        exception_caught();                                      \
+    else if (exception_enter())
+
+/* Parts of exception_try(): the first returns whether to save the signal
+ * mask, the others start the region or close it after a longjmp.
  */
-bool exception_setup(bool limit_time);
+extern sigjmp_buf exception_env;
+int exception_prepare(bool limit_time);
+bool exception_enter();
+void exception_caught();
 
 /* Call once past risky code */
 void exception_cancel();
@@ -56,6 +199,7 @@ void trigger_exception(char *msg);
 /* Tested program use our versions of malloc and free */
 #define malloc test_malloc
 #define free test_free
+#define realloc test_realloc
 
 /* Use undef to avoid strdup redefined error */
 #undef strdup
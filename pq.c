@@ -0,0 +1,194 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "pq.h"
+
+/* Initial size of the stack of pq_find(), doubled when full */
+#define PQ_FIND_STACK 16
+
+static int pq_cmp(const pq_t *pq, const element_t *a, const element_t *b)
+{
+    if (pq->mode == Q_KEY_NUMERIC)
+        return q_cmp_numeric(NULL, a, b);
+    return q_cmp_string(NULL, a, b);
+}
+
+/* Link two roots: the larger becomes the first child of the smaller */
+static pq_node_t *pq_link(const pq_t *pq, pq_node_t *a, pq_node_t *b)
+{
+    if (pq_cmp(pq, &b->elem, &a->elem) < 0) {
+        pq_node_t *tmp = a;
+        a = b;
+        b = tmp;
+    }
+    list_add(&b->elem.list, &a->children);
+    return a;
+}
+
+/* Create an empty priority queue */
+pq_t *pq_new(q_key_mode_t mode)
+{
+    pq_t *pq = malloc(sizeof(pq_t));
+    if (!pq)
+        return NULL;
+    pq->root = NULL;
+    pq->size = 0;
+    pq->mode = mode;
+    return pq;
+}
+
+/* Free a priority queue and all its nodes */
+void pq_free(pq_t *pq)
+{
+    if (!pq)
+        return;
+    /* Splice the children of every released node into the pending list, so
+     * trees of any depth are freed without recursion
+     */
+    LIST_HEAD(pending);
+    if (pq->root)
+        list_add(&pq->root->elem.list, &pending);
+    while (!list_empty(&pending)) {
+        pq_node_t *node = list_first_entry(&pending, pq_node_t, elem.list);
+        list_del(&node->elem.list);
+        list_splice(&node->children, &pending);
+        q_release_element(&node->elem);
+    }
+    free(pq);
+}
+
+/* Insert a copy of a string */
+pq_node_t *pq_push(pq_t *pq, const char *s)
+{
+    if (!pq)
+        return NULL;
+    pq_node_t *node = malloc(sizeof(pq_node_t));
+    if (!node)
+        return NULL;
+    if (!q_element_set(&node->elem, s, pq->mode)) {
+        free(node);
+        return NULL;
+    }
+    INIT_LIST_HEAD(&node->elem.list);
+    INIT_LIST_HEAD(&node->children);
+    pq->root = pq->root ? pq_link(pq, pq->root, node) : node;
+    pq->size++;
+    return node;
+}
+
+/* Get the minimum element without removing it */
+element_t *pq_min(pq_t *pq)
+{
+    return pq && pq->root ? &pq->root->elem : NULL;
+}
+
+/* Remove the minimum element */
+element_t *pq_pop_min(pq_t *pq)
+{
+    if (!pq || !pq->root)
+        return NULL;
+    pq_node_t *min = pq->root;
+
+    /* Two-pass pairing: link the children in pairs from left to right, then
+     * fold the pairs into a single tree from right to left
+     */
+    LIST_HEAD(pairs);
+    while (!list_empty(&min->children)) {
+        pq_node_t *a = list_first_entry(&min->children, pq_node_t, elem.list);
+        list_del_init(&a->elem.list);
+        if (!list_empty(&min->children)) {
+            pq_node_t *b =
+                list_first_entry(&min->children, pq_node_t, elem.list);
+            list_del_init(&b->elem.list);
+            a = pq_link(pq, a, b);
+        }
+        list_add_tail(&a->elem.list, &pairs);
+    }
+    pq_node_t *root = NULL;
+    while (!list_empty(&pairs)) {
+        pq_node_t *t = list_last_entry(&pairs, pq_node_t, elem.list);
+        list_del_init(&t->elem.list);
+        root = root ? pq_link(pq, t, root) : t;
+    }
+
+    pq->root = root;
+    pq->size--;
+    INIT_LIST_HEAD(&min->elem.list);
+    return &min->elem;
+}
+
+/* Replace the value of a node by a smaller one */
+bool pq_decrease_key(pq_t *pq, pq_node_t *node, const char *s)
+{
+    if (!pq || !node)
+        return false;
+    element_t e;
+    if (!q_element_set(&e, s, pq->mode))
+        return false;
+    if (pq_cmp(pq, &e, &node->elem) > 0) {
+        q_value_put(e.value, e.len);
+        return false;
+    }
+    q_value_put(node->elem.value, node->elem.len);
+    node->elem.value = e.value;
+    node->elem.len = e.len;
+    node->elem.key = e.key;
+
+    /* Cut the subtree from its parent and link it with the root again */
+    if (node != pq->root) {
+        list_del_init(&node->elem.list);
+        pq->root = pq_link(pq, pq->root, node);
+    }
+    return true;
+}
+
+/* Move all nodes of a priority queue into another */
+void pq_meld(pq_t *dst, pq_t *src)
+{
+    if (!dst || !src || dst == src || !src->root)
+        return;
+    dst->root = dst->root ? pq_link(dst, dst->root, src->root) : src->root;
+    dst->size += src->size;
+    src->root = NULL;
+    src->size = 0;
+}
+
+/* Find a node by value */
+pq_node_t *pq_find(pq_t *pq, const char *s)
+{
+    if (!pq || !pq->root)
+        return NULL;
+    /* Depth-first walk with an explicit stack, trees can be deep but most are
+     * shallow and wide: grow the stack as needed
+     */
+    int cap = PQ_FIND_STACK;
+    pq_node_t **stack = malloc(cap * sizeof(pq_node_t *));
+    if (!stack)
+        return NULL;
+    pq_node_t *found = NULL;
+    int top = 0;
+    stack[top++] = pq->root;
+    while (top && !found) {
+        pq_node_t *node = stack[--top];
+        if (!strcmp(node->elem.value, s)) {
+            found = node;
+            break;
+        }
+        pq_node_t *child;
+        list_for_each_entry (child, &node->children, elem.list) {
+            if (top == cap) {
+                pq_node_t **grown =
+                    realloc(stack, 2 * cap * sizeof(pq_node_t *));
+                if (!grown) {
+                    free(stack);
+                    return NULL;
+                }
+                stack = grown;
+                cap *= 2;
+            }
+            stack[top++] = child;
+        }
+    }
+    free(stack);
+    return found;
+}
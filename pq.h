@@ -0,0 +1,114 @@
+#ifndef LAB0_PQ_H
+#define LAB0_PQ_H
+
+/* Priority queue of strings implemented as a pairing heap.
+ *
+ * Every node embeds an element_t, so values are allocated, compared and
+ * released exactly like queue elements: pq_pop_min() hands out an element_t
+ * which is freed with q_release_element(). The children of a node are kept in
+ * a circular list threaded through the list member of their element_t, which
+ * lets pq_decrease_key() unlink a node from its parent in O(1).
+ *
+ * Push, meld and decrease-key take O(1) time, pop-min O(log n) amortized.
+ */
+
+#include <stdbool.h>
+
+#include "list.h"
+#include "queue.h"
+
+/**
+ * pq_node_t - Node of a priority queue
+ * @elem: element holding the value, first so that q_release_element() frees
+ *        the whole node
+ * @children: list of the child nodes, linked through their @elem.list
+ */
+typedef struct {
+    element_t elem;
+    struct list_head children;
+} pq_node_t;
+
+/**
+ * pq_t - Priority queue
+ * @root: node with the minimum value, NULL if empty
+ * @size: number of nodes
+ * @mode: how values are ordered
+ */
+typedef struct {
+    pq_node_t *root;
+    int size;
+    q_key_mode_t mode;
+} pq_t;
+
+/**
+ * pq_new() - Create an empty priority queue
+ * @mode: order values by string or by numeric key
+ *
+ * Return: NULL for allocation failed
+ */
+pq_t *pq_new(q_key_mode_t mode);
+
+/**
+ * pq_free() - Free a priority queue and all its nodes, no effect if NULL
+ * @pq: priority queue
+ */
+void pq_free(pq_t *pq);
+
+/**
+ * pq_push() - Insert a copy of a string
+ * @pq: priority queue
+ * @s: string to insert
+ *
+ * Return: a handle for pq_decrease_key(), valid until the node is popped.
+ * NULL for allocation failed or @pq is NULL.
+ */
+pq_node_t *pq_push(pq_t *pq, const char *s);
+
+/**
+ * pq_min() - Get the minimum element without removing it
+ * @pq: priority queue
+ *
+ * Return: the minimum element, NULL if @pq is NULL or empty
+ */
+element_t *pq_min(pq_t *pq);
+
+/**
+ * pq_pop_min() - Remove the minimum element
+ * @pq: priority queue
+ *
+ * Return: the removed element, to be released with q_release_element().
+ * NULL if @pq is NULL or empty.
+ */
+element_t *pq_pop_min(pq_t *pq);
+
+/**
+ * pq_decrease_key() - Replace the value of a node by a smaller one
+ * @pq: priority queue holding @node
+ * @node: node to update
+ * @s: new value, which must not order after the current one
+ *
+ * Return: true for success, false if @s orders after the current value or
+ * allocation failed, in which case @node is unchanged
+ */
+bool pq_decrease_key(pq_t *pq, pq_node_t *node, const char *s);
+
+/**
+ * pq_meld() - Move all nodes of a priority queue into another
+ * @dst: priority queue receiving the nodes
+ * @src: priority queue left empty, ordered the same way as @dst
+ */
+void pq_meld(pq_t *dst, pq_t *src);
+
+/**
+ * pq_find() - Find a node by value
+ * @pq: priority queue
+ * @s: value to look for
+ *
+ * Visits the nodes in no particular order, taking O(n) time. Meant for tests
+ * and tools which have no handle at hand.
+ *
+ * Return: a node holding @s, NULL if there is none
+ */
+pq_node_t *pq_find(pq_t *pq, const char *s);
+
+#endif /* LAB0_PQ_H */
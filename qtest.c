@@ -1,7 +1,9 @@
 /* Implementation of testing code for queue code */
 
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
+#include <execinfo.h>
 #include <getopt.h>
 #include <signal.h>
 #include <spawn.h>
@@ -25,7 +27,7 @@
 #include "random.h"
 
 /* Shannon entropy */
-extern double shannon_entropy(const uint8_t *input_data);
+extern double shannon_entropy(const uint8_t *input_data, size_t len);
 extern int show_entropy;
 
 /* Our program needs to use regular malloc/free */
@@ -49,6 +51,10 @@ extern int show_entropy;
 #include "report.h"
 
 #include "coroutine.h"
+#include "extsort.h"
+#include "frozen.h"
+#include "pq.h"
+#include "typed_queue.h"
 
 /* Settable parameters */
 
@@ -56,7 +62,6 @@ extern int show_entropy;
 
 /* How large is a queue before it's considered big.
  * This affects how it gets printed
- * and whether cautious mode is used when freeing the queue
  */
 #define BIG_LIST_SIZE 30
 
@@ -78,12 +83,50 @@ static int string_length = MAXSTRING;
 
 static int descend = 0;
 
+static int numeric = 0;
+
+/* Keep a hash index of values in current and new queues */
+static int indexed = 0;
+
+/* Keep count of the elements of current and new queues */
+static int counted = 0;
+
+/* False positive rate in per mille of the Bloom filter of current and new
+ * queues, 0 for no filter
+ */
+static int filter = 0;
+
+/* Free queues on a background thread */
+static int deferfree = 0;
+
+/* Memory budget of sort in KiB, 0 to sort in memory */
+static int sortmem = 0;
+
+/* Frames telling allocation sites apart */
+static int sitedepth = 1;
+
+/* Check one block in sample fully */
+static int sample = 1;
+
+/* Time limit of each command in microseconds, 0 for none */
+static int budget = 1000000;
+
 static int mode = 0;
 
+/* Priority queue of the pq commands, created by the first push */
+static pq_t *pq = NULL;
+
+/* Element popped last from pq, to check the order of consecutive pops */
+static element_t *pq_last = NULL;
+
+/* Queue moved into front-coded storage by freeze */
+static q_frozen_t *frozen = NULL;
+
 
 #define MIN_RANDSTR_LEN 5
 #define MAX_RANDSTR_LEN 10
 static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
+static const char digits[] = "0123456789";
 /* For queue_insert and queue_remove */
 typedef enum {
     POS_TAIL,
@@ -92,6 +135,47 @@ typedef enum {
 /* Forward declarations */
 static bool q_show(int vlevel);
 
+static inline bool is_numeric_queue()
+{
+    return current && q_key_mode(current->q) == Q_KEY_NUMERIC;
+}
+
+/* Order two elements the way the current queue should, parsing numeric keys
+ * here instead of trusting the ones cached by the queue implementation.
+ */
+static int cmp_entry(const element_t *a, const element_t *b)
+{
+    if (is_numeric_queue()) {
+        long long x = strtoll(a->value, NULL, 10);
+        long long y = strtoll(b->value, NULL, 10);
+        return (x > y) - (x < y);
+    }
+    return strcmp(a->value, b->value);
+}
+
+/* Length of the value of an element, measured here instead of trusting the
+ * one cached by the queue implementation, which has to agree with it.
+ */
+static size_t value_len(const element_t *e)
+{
+    size_t len = strlen(e->value);
+    assert(len == e->len);
+    return len;
+}
+
+/* Payloads exercised by the typed queue command */
+typedef struct {
+    int64_t key;
+    uint32_t seq;
+    char tag[12];
+} record_t;
+
+#define int64_cmp(a, b) ((*(a) > *(b)) - (*(a) < *(b)))
+#define record_cmp(a, b) (((a)->key > (b)->key) - ((a)->key < (b)->key))
+
+DEFINE_QUEUE(i64q, int64_t, int64_cmp)
+DEFINE_QUEUE(recq, record_t, record_cmp)
+
 static bool do_free(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -107,9 +191,6 @@ static bool do_free(int argc, char *argv[])
     }
     error_check();
 
-    if (current && current->size > BIG_LIST_SIZE)
-        set_cautious_mode(false);
-
     struct list_head *qnext = NULL;
     if (chain.size > 1) {
         qnext = (current->chain.next == &chain.head) ? chain.head.next
@@ -119,10 +200,9 @@ static bool do_free(int argc, char *argv[])
     if (current) {
         list_del(&current->chain);
 
-        if (exception_setup(true))
+        exception_try(true)
             q_free(current->q);
         exception_cancel();
-        set_cautious_mode(true);
     }
 
     if (current) {
@@ -133,8 +213,11 @@ static bool do_free(int argc, char *argv[])
 
     q_show(3);
 
-    size_t bcnt = allocation_check();
-    if (!chain.size && bcnt > 0) {
+    /* Only check for leaks once the last queue is gone, since this has to
+     * wait for deferred frees
+     */
+    size_t bcnt;
+    if (!chain.size && (bcnt = allocation_check()) > 0) {
         report(1,
                "ERROR: There is no queue, but %lu blocks are still allocated",
                bcnt);
@@ -153,13 +236,21 @@ static bool do_new(int argc, char *argv[])
 
     bool ok = true;
 
-    if (exception_setup(true)) {
+    exception_try(true) {
         queue_contex_t *qctx = malloc(sizeof(queue_contex_t));
         list_add_tail(&qctx->chain, &chain.head);
 
         qctx->size = 0;
         qctx->q = q_new();
         qctx->id = chain.size++;
+        if (numeric)
+            q_set_key_mode(qctx->q, Q_KEY_NUMERIC);
+        if (counted)
+            q_set_counted(qctx->q, true);
+        if (indexed && !q_set_index(qctx->q, true))
+            report(2, "Indexing new queue failed");
+        if (filter && !q_set_filter(qctx->q, filter / 1000.0))
+            report(2, "Attaching filter to new queue failed");
 
         current = qctx;
     }
@@ -169,44 +260,165 @@ static bool do_new(int argc, char *argv[])
     return ok && !error_check();
 }
 
+static bool do_clone(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling clone on null queue");
+        return false;
+    }
+    error_check();
+
+    struct list_head *clone = NULL;
+    exception_try(true)
+        clone = q_clone(current->q);
+    exception_cancel();
+
+    if (!clone) {
+        fail_count++;
+        if (fail_count < fail_limit) {
+            report(2, "Cloning queue failed");
+            return !error_check();
+        }
+        report(1, "ERROR: Cloning queue failed (%d failures total)",
+               fail_count);
+        return false;
+    }
+
+    /* Same strings in the same order, held by different elements */
+    bool ok = true;
+    struct list_head *a = current->q->next, *b = clone->next;
+    for (; ok && a != current->q && b != clone; a = a->next, b = b->next) {
+        element_t *ea = list_entry(a, element_t, list);
+        element_t *eb = list_entry(b, element_t, list);
+        if (ea == eb || value_len(ea) != value_len(eb) ||
+            strcmp(ea->value, eb->value)) {
+            report(1, "ERROR: Clone differs from queue at '%s'", ea->value);
+            ok = false;
+        }
+    }
+    if (ok && (a != current->q || b != clone)) {
+        report(1, "ERROR: Clone and queue differ in size");
+        ok = false;
+    }
+
+    if (counted)
+        q_set_counted(clone, true);
+    if (indexed && !q_set_index(clone, true))
+        report(2, "Indexing clone failed");
+    if (filter && !q_set_filter(clone, filter / 1000.0))
+        report(2, "Attaching filter to clone failed");
+
+    queue_contex_t *qctx = malloc(sizeof(queue_contex_t));
+    list_add_tail(&qctx->chain, &chain.head);
+    qctx->size = current->size;
+    qctx->q = clone;
+    qctx->id = chain.size++;
+    current = qctx;
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+static bool do_upcase(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling upcase on null queue");
+        return false;
+    }
+    error_check();
+
+    volatile bool ok = true;
+    exception_try(true) {
+        element_t *item;
+        list_for_each_entry (item, current->q, list) {
+            char *value = q_value_writable(item);
+            if (!value) {
+                report(1, "ERROR: Could not get a writable copy of '%s'",
+                       item->value);
+                ok = false;
+                break;
+            }
+            for (size_t i = 0; i < item->len; i++)
+                value[i] = toupper((unsigned char) value[i]);
+        }
+        /* Values changed behind the back of the index and filter */
+        if (q_indexed(current->q) && !q_set_index(current->q, true))
+            report(2, "Reindexing queue failed");
+        q_filter_stats_t stats;
+        if (q_filter_stats(current->q, &stats) &&
+            !q_set_filter(current->q, stats.fp_target))
+            report(2, "Rebuilding filter failed");
+    }
+    exception_cancel();
+
+    q_show(3);
+    return ok && !error_check();
+}
+
 /* TODO: Add a buf_size check of if the buf_size may be less
  * than MIN_RANDSTR_LEN.
  */
-static void fill_rand_string(char *buf, size_t buf_size)
+static void fill_rand_key(char *buf, size_t buf_size, bool numeric_key)
 {
     size_t len = 0;
     while (len < MIN_RANDSTR_LEN)
         len = rand() % buf_size;
 
     randombytes((uint8_t *) buf, len);
-    for (size_t n = 0; n < len; n++)
-        buf[n] = charset[buf[n] % (sizeof(charset) - 1)];
+    /* Numeric queues get random decimal keys instead of words */
+    if (numeric_key) {
+        for (size_t n = 0; n < len; n++)
+            buf[n] = digits[(uint8_t) buf[n] % (sizeof(digits) - 1)];
+    } else {
+        for (size_t n = 0; n < len; n++)
+            buf[n] = charset[buf[n] % (sizeof(charset) - 1)];
+    }
     buf[len] = '\0';
 }
 
+static void fill_rand_string(char *buf, size_t buf_size)
+{
+    fill_rand_key(buf, buf_size, is_numeric_queue());
+}
+
+/* Check in simulation mode that an operation takes constant time */
+static bool check_constant(int argc, char *argv[], bool (*is_const)(void))
+{
+    if (argc != 1) {
+        report(1, "%s does not need arguments in simulation mode", argv[0]);
+        return false;
+    }
+    if (!is_const()) {
+        report(1, "ERROR: Probably not constant time or wrong implementation");
+        return false;
+    }
+    report(1, "Probably constant time");
+    return true;
+}
+
 /* insertion */
 static bool queue_insert(position_t pos, int argc, char *argv[])
 {
-    if (simulation) {
-        if (argc != 1) {
-            report(1, "%s does not need arguments in simulation mode", argv[0]);
-            return false;
-        }
-        bool ok =
-            pos == POS_TAIL ? is_insert_tail_const() : is_insert_head_const();
-        if (!ok) {
-            report(1,
-                   "ERROR: Probably not constant time or wrong implementation");
-            return false;
-        }
-        report(1, "Probably constant time");
-        return ok;
-    }
+    if (simulation)
+        return check_constant(argc, argv,
+                              pos == POS_TAIL ? is_insert_tail_const
+                                              : is_insert_head_const);
 
     char *lasts = NULL;
     char randstr_buf[MAX_RANDSTR_LEN];
     int reps = 1;
-    bool ok = true, need_rand = false;
+    volatile bool ok = true;
+    bool need_rand = false;
     if (argc != 2 && argc != 3) {
         report(1, "%s needs 1-2 arguments", argv[0]);
         return false;
@@ -230,48 +442,53 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
                pos == POS_TAIL ? "tail" : "head");
     error_check();
 
-    if (current && exception_setup(true)) {
-        for (int r = 0; ok && r < reps; r++) {
-            if (need_rand)
-                fill_rand_string(randstr_buf, sizeof(randstr_buf));
-            bool rval = pos == POS_TAIL ? q_insert_tail(current->q, inserts)
-                                        : q_insert_head(current->q, inserts);
-            if (rval) {
-                current->size++;
-                element_t *entry =
-                    pos == POS_TAIL
-                        ? list_last_entry(current->q, element_t, list)
-                        : list_first_entry(current->q, element_t, list);
-                char *cur_inserts = entry->value;
-                if (!cur_inserts) {
-                    report(1, "ERROR: Failed to save copy of string in queue");
-                    ok = false;
-                } else if (r == 0 && inserts == cur_inserts) {
-                    report(1,
-                           "ERROR: Need to allocate and copy string for new "
-                           "queue element");
-                    ok = false;
-                    break;
-                } else if (r == 1 && lasts == cur_inserts) {
-                    report(1,
-                           "ERROR: Need to allocate separate string for each "
-                           "queue element");
-                    ok = false;
-                    break;
-                }
-                lasts = cur_inserts;
-            } else {
-                fail_count++;
-                if (fail_count < fail_limit)
-                    report(2, "Insertion of %s failed", inserts);
-                else {
-                    report(1,
-                           "ERROR: Insertion of %s failed (%d failures total)",
-                           inserts, fail_count);
-                    ok = false;
+    if (current) {
+        exception_try(true) {
+            for (int r = 0; ok && r < reps; r++) {
+                if (need_rand)
+                    fill_rand_string(randstr_buf, sizeof(randstr_buf));
+                bool rval = pos == POS_TAIL
+                                ? q_insert_tail(current->q, inserts)
+                                : q_insert_head(current->q, inserts);
+                if (rval) {
+                    current->size++;
+                    element_t *entry =
+                        pos == POS_TAIL
+                            ? list_last_entry(current->q, element_t, list)
+                            : list_first_entry(current->q, element_t, list);
+                    char *cur_inserts = entry->value;
+                    if (!cur_inserts) {
+                        report(1,
+                               "ERROR: Failed to save copy of string in queue");
+                        ok = false;
+                    } else if (r == 0 && inserts == cur_inserts) {
+                        report(1,
+                               "ERROR: Need to allocate and copy string for "
+                               "new queue element");
+                        ok = false;
+                        break;
+                    } else if (r == 1 && lasts == cur_inserts) {
+                        report(1,
+                               "ERROR: Need to allocate separate string for "
+                               "each queue element");
+                        ok = false;
+                        break;
+                    }
+                    lasts = cur_inserts;
+                } else {
+                    fail_count++;
+                    if (fail_count < fail_limit)
+                        report(2, "Insertion of %s failed", inserts);
+                    else {
+                        report(1,
+                               "ERROR: Insertion of %s failed (%d failures "
+                               "total)",
+                               inserts, fail_count);
+                        ok = false;
+                    }
                 }
+                ok = ok && !error_check();
             }
-            ok = ok && !error_check();
         }
     }
     exception_cancel();
@@ -299,21 +516,10 @@ static bool queue_remove(position_t pos, int argc, char *argv[])
      * We shall figure out the exact reasons and resolve later.
      */
 #if !(defined(__aarch64__) && defined(__APPLE__))
-    if (simulation) {
-        if (argc != 1) {
-            report(1, "%s does not need arguments in simulation mode", argv[0]);
-            return false;
-        }
-        bool ok =
-            pos == POS_TAIL ? is_remove_tail_const() : is_remove_head_const();
-        if (!ok) {
-            report(1,
-                   "ERROR: Probably not constant time or wrong implementation");
-            return false;
-        }
-        report(1, "Probably constant time");
-        return ok;
-    }
+    if (simulation)
+        return check_constant(argc, argv,
+                              pos == POS_TAIL ? is_remove_tail_const
+                                              : is_remove_head_const);
 #endif
 
     if (argc != 1 && argc != 2) {
@@ -338,9 +544,11 @@ static bool queue_remove(position_t pos, int argc, char *argv[])
 
     bool check = argc > 1;
     bool ok = true;
+    size_t check_len = 0;
     if (check) {
         strncpy(checks, argv[1], string_length + 1);
         checks[string_length] = '\0';
+        check_len = strlen(checks);
     }
 
     removes[0] = '\0';
@@ -353,15 +561,23 @@ static bool queue_remove(position_t pos, int argc, char *argv[])
     error_check();
 
     element_t *re = NULL;
-    if (current && exception_setup(true))
-        re = pos == POS_TAIL
-                 ? q_remove_tail(current->q, removes, string_length + 1)
-                 : q_remove_head(current->q, removes, string_length + 1);
+    if (current) {
+        exception_try(true)
+            re = pos == POS_TAIL
+                     ? q_remove_tail(current->q, removes, string_length + 1)
+                     : q_remove_head(current->q, removes, string_length + 1);
+    }
     exception_cancel();
 
     bool is_null = re ? false : true;
+    size_t removed_len = 0;
 
     if (!is_null) {
+        /* The copy is truncated to string_length characters */
+        removed_len = value_len(re);
+        if (removed_len > (size_t) string_length)
+            removed_len = (size_t) string_length;
+
         // q_remove_head and q_remove_tail are not responsible for releasing
         // node
         q_release_element(re);
@@ -370,6 +586,9 @@ static bool queue_remove(position_t pos, int argc, char *argv[])
         if (removes[0] == '\0') {
             report(1, "ERROR: Failed to store removed value");
             ok = false;
+        } else if (removes[removed_len] != '\0') {
+            report(1, "ERROR: Removed value is not terminated at its length");
+            ok = false;
         }
 
         /* Check whether padding in array removes are still initial value 'X'.
@@ -398,7 +617,8 @@ static bool queue_remove(position_t pos, int argc, char *argv[])
         }
     }
 
-    if (ok && check && strcmp(removes, checks)) {
+    if (ok && check &&
+        (removed_len != check_len || memcmp(removes, checks, check_len))) {
         report(1, "ERROR: Removed value %s != expected value %s", removes,
                checks);
         ok = false;
@@ -444,13 +664,14 @@ static bool do_dedup(int argc, char *argv[])
             if (!tmp)
                 break;
             INIT_LIST_HEAD(&tmp->list);
-            slen = strlen(item->value) + 1;
+            slen = item->len + 1;
             tmp->value = malloc(slen);
             if (!tmp->value) {
                 free(tmp);
                 break;
             }
             memcpy(tmp->value, item->value, slen);
+            tmp->len = item->len;
             list_add_tail(&tmp->list, &l_copy);
         }
         // Return false if the loop does not leave properly
@@ -467,7 +688,7 @@ static bool do_dedup(int argc, char *argv[])
     }
 
     bool ok = true;
-    if (exception_setup(true))
+    exception_try(true)
         ok = q_delete_dup(current->q);
     exception_cancel();
 
@@ -487,14 +708,12 @@ static bool do_dedup(int argc, char *argv[])
         // Skip comparison with new list if the string is duplicate
         bool is_next_dup =
             item->list.next != &l_copy &&
-            strcmp(list_entry(item->list.next, element_t, list)->value,
-                   item->value) == 0;
+            cmp_entry(list_entry(item->list.next, element_t, list), item) == 0;
         if (is_this_dup || is_next_dup) {
             // Update list size
             current->size--;
         } else if (l_tmp != current->q &&
-                   strcmp(list_entry(l_tmp, element_t, list)->value,
-                          item->value) == 0)
+                   cmp_entry(list_entry(l_tmp, element_t, list), item) == 0)
             l_tmp = l_tmp->next;
         else
             ok = false;
@@ -516,6 +735,261 @@ static bool do_dedup(int argc, char *argv[])
     return ok && !error_check();
 }
 
+/* An index or filter may have to grow as elements are moved into a queue */
+static bool grows_with_queue(struct list_head *q)
+{
+    return q_indexed(q) || q_filter_stats(q, NULL);
+}
+
+/* Count the elements equal to a value the way the current queue compares */
+static int count_value(const char *s)
+{
+    element_t key = {.value = (char *) s, .len = strlen(s)};
+    int n = 0;
+    element_t *item;
+    list_for_each_entry (item, current->q, list) {
+        if (cmp_entry(item, &key) == 0)
+            n++;
+    }
+    return n;
+}
+
+static bool do_contains(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling contains on null queue");
+        return false;
+    }
+    error_check();
+
+    bool found = false;
+    set_noallocate_mode(true);
+    exception_try(true)
+        found = q_contains(current->q, argv[1]);
+    exception_cancel();
+    set_noallocate_mode(false);
+
+    bool ok = true;
+    if (found != (count_value(argv[1]) > 0)) {
+        report(1, "ERROR: Queue %s %s, but contains says otherwise",
+               found ? "does not hold" : "holds", argv[1]);
+        ok = false;
+    } else {
+        report(2, "Queue %s %s", found ? "holds" : "does not hold", argv[1]);
+    }
+
+    return ok && !error_check();
+}
+
+static bool do_delval(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling delval on null queue");
+        return false;
+    }
+    error_check();
+
+    int expected = count_value(argv[1]), n = 0;
+    exception_try(true)
+        n = q_delete_value(current->q, argv[1]);
+    exception_cancel();
+
+    bool ok = true;
+    if (n != expected) {
+        report(1, "ERROR: Deleted %d nodes holding %s, expected %d", n,
+               argv[1], expected);
+        ok = false;
+    } else if (count_value(argv[1])) {
+        report(1, "ERROR: Queue still holds %s after deleting it", argv[1]);
+        ok = false;
+    } else {
+        report(2, "Deleted %d nodes holding %s", n, argv[1]);
+    }
+    current->size -= n;
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+static bool do_filter(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    q_filter_stats_t stats;
+    if (!current || !q_filter_stats(current->q, &stats)) {
+        report(3, "Warning: Current queue has no filter");
+        return false;
+    }
+
+    /* What q_set_index() would take: 16-byte slots, at most 3/4 in use */
+    size_t slots = 16;
+    while (current->size * 4 > slots * 3)
+        slots <<= 1;
+    report(1,
+           "Filter of %lu elements (capacity %lu): %lu counters, %d hashes, "
+           "%lu bytes",
+           stats.count, stats.capacity, stats.counters, stats.hashes,
+           stats.bytes);
+    report(1,
+           "False positive rate %.3f%% estimated, %.3f%% targeted; an index "
+           "would take %lu bytes",
+           stats.fp_estimate * 100, stats.fp_target * 100, slots * 16);
+    return true;
+}
+
+static bool do_freeze(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling freeze on null queue");
+        return false;
+    }
+    if (frozen) {
+        report(1, "ERROR: A queue is frozen already, thaw it first");
+        return false;
+    }
+    error_check();
+
+    exception_try(true)
+        frozen = q_freeze(current->q, descend);
+    exception_cancel();
+
+    if (!frozen) {
+        report(1, "ERROR: Could not freeze queue, is it sorted in %s order?",
+               descend ? "descending" : "ascending");
+        return false;
+    }
+    bool ok = true;
+    if (!list_empty(current->q)) {
+        report(1, "ERROR: Queue is not empty after freezing");
+        ok = false;
+    }
+
+    q_frozen_stats_t stats;
+    q_frozen_stats(frozen, &stats);
+    if (stats.count != (size_t) current->size) {
+        report(1, "ERROR: Froze %lu strings out of %d", stats.count,
+               current->size);
+        ok = false;
+    }
+    current->size = 0;
+    report(1, "Froze %lu strings into %lu bytes, %lu bytes as a queue",
+           stats.count, stats.bytes, stats.list_bytes);
+    if (stats.list_bytes)
+        report(2, "Saved %.1f%% of memory",
+               100.0 - 100.0 * stats.bytes / stats.list_bytes);
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+static bool do_thaw(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q || !frozen) {
+        report(3, "Warning: Calling thaw without a frozen or current queue");
+        return false;
+    }
+    error_check();
+
+    q_frozen_stats_t stats;
+    q_frozen_stats(frozen, &stats);
+    bool ok = false;
+    exception_try(true)
+        ok = q_thaw(frozen, current->q);
+    exception_cancel();
+
+    if (ok) {
+        frozen = NULL;
+        current->size += stats.count;
+    } else {
+        fail_count++;
+        if (fail_count < fail_limit) {
+            report(2, "Thawing queue failed");
+            ok = true;
+        } else {
+            report(1, "ERROR: Thawing queue failed (%d failures total)",
+                   fail_count);
+        }
+    }
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+static bool do_ffind(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    if (!frozen) {
+        report(3, "Warning: Calling ffind without a frozen queue");
+        return false;
+    }
+    error_check();
+
+    size_t index = 0;
+    bool found = false;
+    exception_try(true)
+        found = q_frozen_find(frozen, argv[1], &index);
+    exception_cancel();
+
+    /* Walk the frozen queue to check the position */
+    q_frozen_iter_t it;
+    if (!q_frozen_iter_init(&it, frozen, 0)) {
+        report(1, "INTERNAL ERROR.  Could not allocate iterator");
+        return false;
+    }
+    element_t key = {.value = argv[1]};
+    size_t expected = 0;
+    bool equal = false;
+    for (const char *s; (s = q_frozen_next(&it)); expected++) {
+        element_t e = {.value = (char *) s};
+        int c = cmp_entry(&e, &key);
+        if (descend ? c <= 0 : c >= 0) {
+            equal = c == 0;
+            break;
+        }
+    }
+    q_frozen_iter_end(&it);
+
+    bool ok = true;
+    if (index != expected || found != equal) {
+        report(1, "ERROR: Found %s at %lu (%s), expected at %lu (%s)",
+               argv[1], index, found ? "equal" : "not equal", expected,
+               equal ? "equal" : "not equal");
+        ok = false;
+    } else if (found) {
+        report(2, "Found %s at %lu", argv[1], index);
+    } else {
+        report(2, "No %s, it would go at %lu", argv[1], index);
+    }
+    return ok && !error_check();
+}
+
 static bool do_reverse(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -528,8 +1002,10 @@ static bool do_reverse(int argc, char *argv[])
     error_check();
 
     set_noallocate_mode(true);
-    if (current && exception_setup(true))
-        q_reverse(current->q);
+    if (current) {
+        exception_try(true)
+            q_reverse(current->q);
+    }
     exception_cancel();
 
     set_noallocate_mode(false);
@@ -539,13 +1015,17 @@ static bool do_reverse(int argc, char *argv[])
 
 static bool do_size(int argc, char *argv[])
 {
+    /* Sizing is only constant time on a counted queue, which dudect uses */
+    if (simulation)
+        return check_constant(argc, argv, is_size_const);
+
     if (argc != 1 && argc != 2) {
         report(1, "%s takes 0-1 arguments", argv[0]);
         return false;
     }
 
     int reps = 1;
-    bool ok = true;
+    volatile bool ok = true;
     if (argc != 1 && argc != 2) {
         report(1, "%s needs 0-1 arguments", argv[0]);
         return false;
@@ -556,15 +1036,17 @@ static bool do_size(int argc, char *argv[])
             report(1, "Invalid number of calls to size '%s'", argv[2]);
     }
 
-    int cnt = 0;
+    volatile int cnt = 0;
     if (!current || !current->q)
         report(3, "Warning: Calling size on null queue");
     error_check();
 
-    if (current && exception_setup(true)) {
-        for (int r = 0; ok && r < reps; r++) {
-            cnt = q_size(current->q);
-            ok = ok && !error_check();
+    if (current) {
+        exception_try(true) {
+            for (int r = 0; ok && r < reps; r++) {
+                cnt = q_size(current->q);
+                ok = ok && !error_check();
+            }
         }
     }
     exception_cancel();
@@ -585,8 +1067,31 @@ static bool do_size(int argc, char *argv[])
     return ok && !error_check();
 }
 
+/* Compare the time sort takes on sorted and random input in simulation mode.
+ * Sorting is not expected to take constant time, so neither outcome is an
+ * error.
+ */
+static bool sort_classes(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s does not need arguments in simulation mode", argv[0]);
+        return false;
+    }
+    bool same = is_sort_const();
+    double sorted, random;
+    dut_class_means(&sorted, &random);
+    report(1, "Sorted input: %.0f cycles, random input: %.0f cycles (%+.1f%%)",
+           sorted, random, sorted > 0 ? (random - sorted) * 100 / sorted : 0);
+    report(1, same ? "Probably same time on both"
+                   : "Time depends on the order of input");
+    return true;
+}
+
 bool do_sort(int argc, char *argv[])
 {
+    if (simulation)
+        return sort_classes(argc, argv);
+
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
@@ -603,13 +1108,28 @@ bool do_sort(int argc, char *argv[])
         report(3, "Warning: Calling sort on single node");
     error_check();
 
-    set_noallocate_mode(true);
-    if (current && exception_setup(true))
-        q_sort(current->q, descend);
-    exception_cancel();
-    set_noallocate_mode(false);
-
     bool ok = true;
+    if (sortmem) {
+        if (current) {
+            exception_try(true) {
+                if (!q_sort_external(current->q, descend,
+                                     (size_t) sortmem * 1024)) {
+                    report(1, "ERROR: External sort failed");
+                    ok = false;
+                }
+            }
+        }
+        exception_cancel();
+    } else {
+        set_noallocate_mode(true);
+        if (current) {
+            exception_try(true)
+                q_sort(current->q, descend);
+        }
+        exception_cancel();
+        set_noallocate_mode(false);
+    }
+
     if (current && current->size) {
         for (struct list_head *cur_l = current->q->next;
              cur_l != current->q && --cnt; cur_l = cur_l->next) {
@@ -617,13 +1137,13 @@ bool do_sort(int argc, char *argv[])
             element_t *item, *next_item;
             item = list_entry(cur_l, element_t, list);
             next_item = list_entry(cur_l->next, element_t, list);
-            if (!descend && strcmp(item->value, next_item->value) > 0) {
+            if (!descend && cmp_entry(item, next_item) > 0) {
                 report(1, "ERROR: Not sorted in ascending order");
                 ok = false;
                 break;
             }
 
-            if (descend && strcmp(item->value, next_item->value) < 0) {
+            if (descend && cmp_entry(item, next_item) < 0) {
                 report(1, "ERROR: Not sorted in descending order");
                 ok = false;
                 break;
@@ -635,8 +1155,371 @@ bool do_sort(int argc, char *argv[])
     return ok && !error_check();
 }
 
+static int ref_string(const element_t *a, const element_t *b)
+{
+    return strcmp(a->value, b->value);
+}
+
+static int ref_casefold(const element_t *a, const element_t *b)
+{
+    return strcasecmp(a->value, b->value);
+}
+
+static int ref_length(const element_t *a, const element_t *b)
+{
+    size_t la = strlen(a->value), lb = strlen(b->value);
+    if (la != lb)
+        return la < lb ? -1 : 1;
+    return strcmp(a->value, b->value);
+}
+
+/* Orders selectable by sortby: the comparator under test and an independent
+ * reference used to check its result
+ */
+static const struct {
+    const char *name;
+    q_cmp_func_t cmp;
+    int (*check)(const element_t *a, const element_t *b);
+} sort_orders[] = {
+    {"string", q_cmp_string, ref_string},
+    {"numeric", q_cmp_numeric, cmp_entry},
+    {"casefold", q_cmp_casefold, ref_casefold},
+    {"length", q_cmp_length, ref_length},
+};
+
+/* Look up the order named by the argument of sortby or mergeby */
+static int find_sort_order(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs an order: string, numeric, casefold or length",
+               argv[0]);
+        return -1;
+    }
+
+    for (int i = 0; i < (int) (sizeof(sort_orders) / sizeof(sort_orders[0]));
+         i++) {
+        if (!strcmp(argv[1], sort_orders[i].name))
+            return i;
+    }
+    report(1, "Unknown order '%s'", argv[1]);
+    return -1;
+}
+
+/* An element and its position before a sort or merge */
+typedef struct {
+    const element_t *e;
+    int rank;
+} ranked_t;
+
+static int cmp_ranked(const void *a, const void *b)
+{
+    const element_t *x = ((const ranked_t *) a)->e;
+    const element_t *y = ((const ranked_t *) b)->e;
+    return (x > y) - (x < y);
+}
+
+/* Append the elements of @q to the @n already in @ranks, up to @max */
+static int rank_queue(ranked_t *ranks, int n, int max, struct list_head *q)
+{
+    element_t *item;
+    list_for_each_entry (item, q, list) {
+        if (n == max)
+            break;
+        ranks[n].e = item;
+        ranks[n].rank = n;
+        n++;
+    }
+    return n;
+}
+
+/* Check that @q holds exactly the @n elements of @ranks, sorted in @order,
+ * and that equal elements kept their relative positions
+ */
+static bool check_stable(struct list_head *q,
+                         ranked_t *ranks,
+                         int n,
+                         int order)
+{
+    qsort(ranks, n, sizeof(ranked_t), cmp_ranked);
+
+    const element_t *prev = NULL;
+    int prev_rank = -1, cnt = 0;
+    element_t *item;
+    list_for_each_entry (item, q, list) {
+        ranked_t key = {.e = item};
+        ranked_t *r = cnt < n ? bsearch(&key, ranks, n, sizeof(ranked_t),
+                                        cmp_ranked)
+                              : NULL;
+        if (!r || r->rank < 0) {
+            report(1, "ERROR: Element '%s' was not in the queues, or is there "
+                      "twice", item->value);
+            return false;
+        }
+        if (prev) {
+            int c = sort_orders[order].check(prev, item);
+            if (c > 0) {
+                report(1, "ERROR: Not sorted in %s order",
+                       sort_orders[order].name);
+                return false;
+            }
+            if (!c && prev_rank > r->rank) {
+                report(1, "ERROR: Equal elements '%s' and '%s' swapped",
+                       prev->value, item->value);
+                return false;
+            }
+        }
+        prev = item;
+        prev_rank = r->rank;
+        /* Mark it seen */
+        r->rank = -1;
+        cnt++;
+    }
+    if (cnt != n) {
+        report(1, "ERROR: Queue has %d elements, expected %d", cnt, n);
+        return false;
+    }
+    return true;
+}
+
+static bool do_sortby(int argc, char *argv[])
+{
+    int order = find_sort_order(argc, argv);
+    if (order < 0)
+        return false;
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling sortby on null queue");
+        return false;
+    }
+    if (sort_orders[order].cmp == q_cmp_numeric && !is_numeric_queue()) {
+        report(1, "ERROR: Queue is not in numeric key mode");
+        return false;
+    }
+    error_check();
+
+    ranked_t *ranks = malloc((current->size + 1) * sizeof(ranked_t));
+    if (!ranks) {
+        report(1, "INTERNAL ERROR.  Could not allocate space for ranks");
+        return false;
+    }
+    int n = rank_queue(ranks, 0, current->size, current->q);
+
+    set_noallocate_mode(true);
+    exception_try(true)
+        q_sort_by(current->q, sort_orders[order].cmp, NULL);
+    exception_cancel();
+    set_noallocate_mode(false);
+
+    bool ok = check_stable(current->q, ranks, n, order);
+    free(ranks);
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+/* Compare two entries in the order selected by the descend option */
+static int cmp_rank(const element_t *a, const element_t *b)
+{
+    return descend ? cmp_entry(b, a) : cmp_entry(a, b);
+}
+
+static bool do_topk(int argc, char *argv[])
+{
+    int k;
+    if (argc != 2 || !get_int(argv[1], &k) || k < 0) {
+        report(1, "%s needs a non-negative k", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling topk on null queue");
+        return false;
+    }
+    error_check();
+
+    int cnt = 0;
+    set_noallocate_mode(true);
+    exception_try(true)
+        cnt = q_topk(current->q, k, descend);
+    exception_cancel();
+    set_noallocate_mode(false);
+
+    bool ok = true;
+    int expect = k < current->size ? k : current->size;
+    if (cnt != expect) {
+        report(1, "ERROR: Kept %d elements at the front, expected %d", cnt,
+               expect);
+        ok = false;
+    }
+
+    /* The front is sorted and nothing behind it ranks before its last one */
+    element_t *last = NULL, *item;
+    int i = 0;
+    list_for_each_entry (item, current->q, list) {
+        if (!ok)
+            break;
+        if (i < expect) {
+            if (last && cmp_rank(last, item) > 0) {
+                report(1, "ERROR: Top %d elements are not sorted", expect);
+                ok = false;
+            }
+            last = item;
+        } else if (last && cmp_rank(item, last) < 0) {
+            report(1, "ERROR: Element '%s' belongs to the top %d",
+                   item->value, expect);
+            ok = false;
+        }
+        i++;
+    }
+    if (ok && i != current->size) {
+        report(1, "ERROR: Queue has %d elements, expected %d", i,
+               (int) current->size);
+        ok = false;
+    }
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+static bool do_nth(int argc, char *argv[])
+{
+    int n;
+    if ((argc != 2 && argc != 3) || !get_int(argv[1], &n)) {
+        report(1, "%s needs a rank n and optionally an expected str", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling nth on null queue");
+        return false;
+    }
+    error_check();
+
+    element_t *nth = NULL;
+    set_noallocate_mode(true);
+    exception_try(true)
+        nth = q_nth_element(current->q, n, descend);
+    exception_cancel();
+    set_noallocate_mode(false);
+
+    bool ok = true;
+    if (n < 0 || n >= current->size) {
+        if (nth) {
+            report(1, "ERROR: Found element for rank %d out of range", n);
+            ok = false;
+        }
+        q_show(3);
+        return ok && !error_check();
+    }
+    if (!nth) {
+        report(1, "ERROR: No element returned for rank %d", n);
+        q_show(3);
+        return false;
+    }
+
+    element_t *item;
+    int i = 0;
+    list_for_each_entry (item, current->q, list) {
+        if (i == n && item != nth) {
+            report(1, "ERROR: Returned element is not at position %d", n);
+            ok = false;
+        } else if ((i < n && cmp_rank(item, nth) > 0) ||
+                   (i > n && cmp_rank(item, nth) < 0)) {
+            report(1, "ERROR: Element '%s' is on the wrong side of '%s'",
+                   item->value, nth->value);
+            ok = false;
+        }
+        if (!ok)
+            break;
+        i++;
+    }
+
+    if (ok) {
+        report(2, "Element of rank %d = %s", n, nth->value);
+        if (argc == 3 && strcmp(argv[2], nth->value)) {
+            report(1, "ERROR: Found '%s' at rank %d, expected '%s'",
+                   nth->value, n, argv[2]);
+            ok = false;
+        }
+    }
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+static bool do_mergein(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q || chain.size < 2) {
+        report(3, "Warning: mergein needs a batch queue and a queue before it");
+        return false;
+    }
+    error_check();
+
+    queue_contex_t *src = current;
+    queue_contex_t *dst =
+        list_entry(src->chain.prev == &chain.head ? chain.head.prev
+                                                  : src->chain.prev,
+                   queue_contex_t, chain);
+    set_noallocate_mode(!grows_with_queue(dst->q));
+    exception_try(true)
+        q_merge_sorted_into(dst->q, src->q, descend);
+    exception_cancel();
+    set_noallocate_mode(false);
+
+    if (!list_empty(src->q)) {
+        /* Interrupted or faulty: keep both queues, wherever elements went */
+        report(1, "ERROR: Batch queue is not empty after merging");
+        struct list_head *node;
+        src->size = dst->size = 0;
+        list_for_each (node, src->q)
+            src->size++;
+        list_for_each (node, dst->q)
+            dst->size++;
+        q_show(3);
+        return false;
+    }
+    dst->size += src->size;
+
+    /* The batch is consumed: drop its queue and continue on the target */
+    list_del(&src->chain);
+    q_free(src->q);
+    free(src);
+    chain.size--;
+    current = dst;
+
+    bool ok = true;
+    int cnt = 0;
+    element_t *item, *last = NULL;
+    list_for_each_entry (item, current->q, list) {
+        if (ok && last && cmp_rank(last, item) > 0) {
+            report(1, "ERROR: Not sorted in %s order",
+                   descend ? "descending" : "ascending");
+            ok = false;
+        }
+        last = item;
+        cnt++;
+    }
+    if (ok && cnt != current->size) {
+        report(1, "ERROR: Queue has %d elements, expected %d", cnt,
+               (int) current->size);
+        ok = false;
+    }
+
+    q_show(3);
+    return ok && !error_check();
+}
+
 static bool do_dm(int argc, char *argv[])
 {
+    /* The classes hold the same number of elements, differing by contents */
+    if (simulation)
+        return check_constant(argc, argv, is_delete_mid_const);
+
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
@@ -649,7 +1532,7 @@ static bool do_dm(int argc, char *argv[])
     error_check();
 
     bool ok = true;
-    if (exception_setup(true))
+    exception_try(true)
         ok = q_delete_mid(current->q);
     exception_cancel();
 
@@ -663,6 +1546,10 @@ static bool do_dm(int argc, char *argv[])
 
 static bool do_swap(int argc, char *argv[])
 {
+    /* The classes hold the same number of elements, differing by contents */
+    if (simulation)
+        return check_constant(argc, argv, is_swap_const);
+
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
@@ -675,7 +1562,7 @@ static bool do_swap(int argc, char *argv[])
     error_check();
 
     set_noallocate_mode(true);
-    if (exception_setup(true))
+    exception_try(true)
         q_swap(current->q);
     exception_cancel();
 
@@ -707,8 +1594,9 @@ static bool do_ascend(int argc, char *argv[])
         report(3, "Warning: Calling ascend on single node");
     error_check();
 
-    if (exception_setup(true))
+    exception_try(true)
         current->size = q_ascend(current->q);
+    exception_cancel();
     set_noallocate_mode(false);
 
     bool ok = true;
@@ -720,7 +1608,7 @@ static bool do_ascend(int argc, char *argv[])
             element_t *item, *next_item;
             item = list_entry(cur_l, element_t, list);
             next_item = list_entry(cur_l->next, element_t, list);
-            if (strcmp(item->value, next_item->value) > 0) {
+            if (cmp_entry(item, next_item) > 0) {
                 report(1,
                        "ERROR: At least one node violated the ordering rule");
                 ok = false;
@@ -754,8 +1642,9 @@ static bool do_descend(int argc, char *argv[])
         report(3, "Warning: Calling descend on single node");
     error_check();
 
-    if (exception_setup(true))
+    exception_try(true)
         current->size = q_descend(current->q);
+    exception_cancel();
     set_noallocate_mode(false);
 
     bool ok = true;
@@ -767,7 +1656,7 @@ static bool do_descend(int argc, char *argv[])
             element_t *item, *next_item;
             item = list_entry(cur_l, element_t, list);
             next_item = list_entry(cur_l->next, element_t, list);
-            if (strcmp(item->value, next_item->value) < 0) {
+            if (cmp_entry(item, next_item) < 0) {
                 report(1,
                        "ERROR: At least one node violated the ordering rule");
                 ok = false;
@@ -801,7 +1690,7 @@ static bool do_reverseK(int argc, char *argv[])
     }
 
     set_noallocate_mode(true);
-    if (exception_setup(true))
+    exception_try(true)
         q_reverseK(current->q, k);
     exception_cancel();
 
@@ -810,6 +1699,30 @@ static bool do_reverseK(int argc, char *argv[])
     return !error_check();
 }
 
+/* Keep only the first queue of the chain, holding @len elements after a merge
+ * emptied the others
+ */
+static void collapse_chain(int len)
+{
+    if (chain.size <= 1)
+        return;
+
+    chain.size = 1;
+    current = list_entry(chain.head.next, queue_contex_t, chain);
+    current->size = len;
+
+    struct list_head *cur = chain.head.next->next;
+    while ((uintptr_t) cur != (uintptr_t) &chain.head) {
+        queue_contex_t *ctx = list_entry(cur, queue_contex_t, chain);
+        cur = cur->next;
+        q_free(ctx->q);
+        free(ctx);
+    }
+
+    chain.head.prev = &current->chain;
+    current->chain.next = &chain.head;
+}
+
 static bool do_merge(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -824,28 +1737,14 @@ static bool do_merge(int argc, char *argv[])
     error_check();
 
     int len = 0;
-    set_noallocate_mode(true);
-    if (current && exception_setup(true))
+    set_noallocate_mode(!grows_with_queue(
+        list_first_entry(&chain.head, queue_contex_t, chain)->q));
+    exception_try(true)
         len = q_merge(&chain.head, descend);
     exception_cancel();
     set_noallocate_mode(false);
 
-    if (q_size(&chain.head) > 1) {
-        chain.size = 1;
-        current = list_entry(chain.head.next, queue_contex_t, chain);
-        current->size = len;
-
-        struct list_head *cur = chain.head.next->next;
-        while ((uintptr_t) cur != (uintptr_t) &chain.head) {
-            queue_contex_t *ctx = list_entry(cur, queue_contex_t, chain);
-            cur = cur->next;
-            q_free(ctx->q);
-            free(ctx);
-        }
-
-        chain.head.prev = &current->chain;
-        current->chain.next = &chain.head;
-    }
+    collapse_chain(len);
 
     bool ok = true;
     if (current && current->size) {
@@ -855,7 +1754,7 @@ static bool do_merge(int argc, char *argv[])
             element_t *item, *next_item;
             item = list_entry(cur_l, element_t, list);
             next_item = list_entry(cur_l->next, element_t, list);
-            if (!descend && strcmp(item->value, next_item->value) > 0) {
+            if (!descend && cmp_entry(item, next_item) > 0) {
                 report(1,
                        "ERROR: Not sorted in ascending order (It might because "
                        "of unsorted queues are merged or there're some flaws "
@@ -865,7 +1764,7 @@ static bool do_merge(int argc, char *argv[])
             }
 
 
-            if (descend && strcmp(item->value, next_item->value) < 0) {
+            if (descend && cmp_entry(item, next_item) < 0) {
                 report(
                     1,
                     "ERROR: Not sorted in descending order (It might because "
@@ -881,6 +1780,353 @@ static bool do_merge(int argc, char *argv[])
     return ok && !error_check();
 }
 
+static bool do_mergeby(int argc, char *argv[])
+{
+    int order = find_sort_order(argc, argv);
+    if (order < 0)
+        return false;
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling mergeby on null queue");
+        return false;
+    }
+    if (sort_orders[order].cmp == q_cmp_numeric && !is_numeric_queue()) {
+        report(1, "ERROR: Queue is not in numeric key mode");
+        return false;
+    }
+    error_check();
+
+    /* Queues earlier in the chain rank before later ones */
+    int total = 0;
+    queue_contex_t *ctx;
+    list_for_each_entry (ctx, &chain.head, chain)
+        total += ctx->size;
+    ranked_t *ranks = malloc((total + 1) * sizeof(ranked_t));
+    if (!ranks) {
+        report(1, "INTERNAL ERROR.  Could not allocate space for ranks");
+        return false;
+    }
+    int n = 0;
+    list_for_each_entry (ctx, &chain.head, chain)
+        n = rank_queue(ranks, n, total, ctx->q);
+
+    int len = 0;
+    set_noallocate_mode(!grows_with_queue(
+        list_first_entry(&chain.head, queue_contex_t, chain)->q));
+    exception_try(true)
+        len = q_merge_by(&chain.head, sort_orders[order].cmp, NULL);
+    exception_cancel();
+    set_noallocate_mode(false);
+
+    collapse_chain(len);
+
+    bool ok = check_stable(current->q, ranks, n, order);
+    free(ranks);
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+
+static void fill_rand_int64(int64_t *v, int rank)
+{
+    randombytes((uint8_t *) v, sizeof(*v));
+}
+
+static void fill_rand_record(record_t *r, int rank)
+{
+    /* Narrow key range so that equal keys are common */
+    r->key = rand() % 1024;
+    r->seq = rank;
+    fill_rand_string(r->tag, sizeof(r->tag));
+}
+
+/* Spread @n random payloads over two queues, sort both, merge them and check
+ * that the result is exactly the payloads in a stable sort: equal keys stay in
+ * the order of their queues before sorting, the first queue ahead. That order
+ * is the rank passed to @fill, which records keep in seq. @scratch has room for
+ * @n name##_expect_t.
+ */
+#define DEFINE_TYPED_CHECK(name, type, cmp, fill)                              \
+    typedef struct {                                                           \
+        type value;                                                            \
+        int rank;                                                              \
+    } name##_expect_t;                                                         \
+                                                                               \
+    static int name##_expect_cmp(const void *a, const void *b)                 \
+    {                                                                          \
+        const name##_expect_t *x = a, *y = b;                                  \
+        int c = cmp(&x->value, &y->value);                                     \
+        if (c)                                                                 \
+            return descend ? -c : c;                                           \
+        return x->rank - y->rank;                                              \
+    }                                                                          \
+                                                                               \
+    static bool name##_check(int n, void *scratch)                             \
+    {                                                                          \
+        struct list_head *q = name##_new(), *batch = name##_new();             \
+        name##_expect_t *expect = scratch;                                     \
+        bool ok = q && batch;                                                  \
+        for (int i = 0; ok && i < n; i++) {                                    \
+            /* Insertions at the head of the batch come out reversed */        \
+            int rank = (i & 1) ? n - 1 - i / 2 : i / 2;                        \
+            type v;                                                            \
+            fill(&v, rank);                                                    \
+            expect[rank].value = v;                                            \
+            expect[rank].rank = rank;                                          \
+            ok = (i & 1) ? name##_insert_head(batch, v)                        \
+                         : name##_insert_tail(q, v);                           \
+        }                                                                      \
+        if (!ok) {                                                             \
+            report(1, "ERROR: Could not allocate typed queue elements");       \
+            name##_free(q);                                                    \
+            name##_free(batch);                                                \
+            return false;                                                      \
+        }                                                                      \
+                                                                               \
+        name##_sort(q, descend);                                               \
+        name##_sort(batch, descend);                                           \
+        name##_merge(q, batch, descend);                                       \
+        if (!list_empty(batch) || name##_size(q) != n) {                       \
+            report(1, "ERROR: Typed queue lost elements while merging");       \
+            ok = false;                                                        \
+        }                                                                      \
+                                                                               \
+        qsort(expect, n, sizeof(name##_expect_t), name##_expect_cmp);          \
+        struct list_head *node;                                                \
+        int k = 0;                                                             \
+        list_for_each (node, q) {                                              \
+            if (!ok)                                                           \
+                break;                                                         \
+            type *v = &list_entry(node, name##_element_t, list)->value;        \
+            if (node->next->prev != node) {                                    \
+                report(1, "ERROR: Typed queue is not doubly linked");          \
+                ok = false;                                                    \
+            } else if (memcmp(v, &expect[k].value, sizeof(type))) {           \
+                report(1,                                                      \
+                       "ERROR: Payload %d differs from a stable sort in %s "   \
+                       "order",                                                \
+                       k, descend ? "descending" : "ascending");               \
+                ok = false;                                                    \
+            }                                                                  \
+            k++;                                                               \
+        }                                                                      \
+                                                                               \
+        /* Drain from both ends to exercise removal */                         \
+        for (int i = 0; ok && i < n; i++) {                                    \
+            type v;                                                            \
+            ok = (i & 1) ? name##_remove_head(q, &v)                           \
+                         : name##_remove_tail(q, &v);                          \
+        }                                                                      \
+        name##_free(q);                                                        \
+        name##_free(batch);                                                    \
+        return ok;                                                             \
+    }
+
+DEFINE_TYPED_CHECK(i64q, int64_t, int64_cmp, fill_rand_int64)
+DEFINE_TYPED_CHECK(recq, record_t, record_cmp, fill_rand_record)
+
+static bool do_typed(int argc, char *argv[])
+{
+    int n = 0;
+    if (argc != 3 || !get_int(argv[2], &n) || n < 0) {
+        report(1, "%s needs a payload type and a number of elements",
+               argv[0]);
+        return false;
+    }
+
+    bool (*check)(int, void *) = NULL;
+    size_t size = 0;
+    if (!strcmp(argv[1], "int64")) {
+        check = i64q_check;
+        size = sizeof(i64q_expect_t);
+    } else if (!strcmp(argv[1], "record")) {
+        check = recq_check;
+        size = sizeof(recq_expect_t);
+    } else {
+        report(1, "Unknown payload type '%s' (int64 or record)", argv[1]);
+        return false;
+    }
+    error_check();
+
+    /* Allocated out of the region, which a timeout may leave at any point */
+    void *scratch = malloc((n + 1) * size);
+    if (!scratch) {
+        report(1, "INTERNAL ERROR.  Could not allocate space for payloads");
+        return false;
+    }
+
+    size_t bcnt = allocation_check();
+    bool ok = false;
+    exception_try(true)
+        ok = check(n, scratch);
+    exception_cancel();
+    free(scratch);
+
+    if (allocation_check() != bcnt) {
+        report(1, "ERROR: Typed queue leaked %lu blocks",
+               allocation_check() - bcnt);
+        ok = false;
+    }
+    if (ok)
+        report(2, "Sorted and merged %d %s payloads in %s order", n, argv[1],
+               descend ? "descending" : "ascending");
+    return ok && !error_check();
+}
+
+/* Report allocations by size class, as counts since start or as changes */
+static void memstat_classes(const alloc_stats_t *stats,
+                            const alloc_stats_t *before)
+{
+    for (int i = 0; i < ALLOC_CLASSES; i++) {
+        size_t allocs = stats->class_allocs[i];
+        long live = (long) stats->class_live[i];
+        if (before) {
+            allocs -= before->class_allocs[i];
+            live -= (long) before->class_live[i];
+        }
+        if (!allocs && !live)
+            continue;
+        char *fmt = before ? "  %s %6lu bytes: %10lu allocated, %+10ld live"
+                           : "  %s %6lu bytes: %10lu allocated, %10ld live";
+        if (i < ALLOC_CLASSES - 1)
+            report(1, fmt, "up to", 8UL << i, allocs, live);
+        else
+            report(1, fmt, "over ", 8UL << (i - 1), allocs, live);
+    }
+}
+
+/* Report an allocation site, naming its frames */
+static void report_site(const alloc_site_t *site, bool leaked)
+{
+    if (leaked)
+        report(1, "%lu blocks (%lu bytes) leaked from:", site->live_blocks,
+               site->live_bytes);
+    else
+        report(1, "%lu allocations (%lu bytes), %lu live (%lu bytes), from:",
+               site->allocs, site->bytes, site->live_blocks,
+               site->live_bytes);
+    char **names = backtrace_symbols(site->frames, site->depth);
+    for (int i = 0; i < site->depth; i++) {
+        if (names)
+            report(1, "    %s", names[i]);
+        else
+            report(1, "    %p", site->frames[i]);
+    }
+    free(names);
+}
+
+/* Report every site holding live blocks */
+static void report_leaks()
+{
+    size_t n = alloc_sites(NULL, 0, true);
+    alloc_site_t *leaks = malloc(n * sizeof(alloc_site_t));
+    if (!leaks)
+        return;
+    n = alloc_sites(leaks, n, true);
+    for (size_t i = 0; i < n; i++)
+        report_site(&leaks[i], true);
+    free(leaks);
+}
+
+static bool do_memsites(int argc, char *argv[])
+{
+    int n = 10;
+    if (argc > 2 || (argc == 2 && (!get_int(argv[1], &n) || n < 1))) {
+        report(1, "%s takes an optional positive number of sites", argv[0]);
+        return false;
+    }
+
+    alloc_site_t *top = malloc(n * sizeof(alloc_site_t));
+    if (!top) {
+        report(1, "ERROR: Could not allocate %d sites", n);
+        return false;
+    }
+    size_t total = alloc_sites(top, n, false);
+    report(1, "%lu allocation sites, most allocating first", total);
+    for (size_t i = 0; i < total && i < (size_t) n; i++)
+        report_site(&top[i], false);
+    free(top);
+    return true;
+}
+
+static double memstat_start;
+
+static bool do_memstat(int argc, char *argv[])
+{
+    alloc_stats_t stats;
+    if (argc == 1) {
+        double since = memstat_start;
+        double elapsed = delta_time(&since);
+        alloc_stats(&stats);
+        report(1,
+               "%lu allocations (%lu bytes), %lu frees (%lu bytes), %lu "
+               "failed in %.3f s: %.0f allocations/s",
+               stats.allocs, stats.alloc_bytes, stats.frees, stats.free_bytes,
+               stats.failed, elapsed,
+               elapsed > 0 ? stats.allocs / elapsed : 0);
+        if (stats.reallocs)
+            report(1, "%lu blocks resized, %lu of them moved", stats.reallocs,
+                   stats.moves);
+        report(1, "Live %lu blocks, %lu bytes; peak %lu blocks, %lu bytes",
+               stats.live_blocks, stats.live_bytes, stats.peak_blocks,
+               stats.peak_bytes);
+        memstat_classes(&stats, NULL);
+        return true;
+    }
+
+    /* Profile the command given as arguments */
+    alloc_stats_t before;
+    alloc_stats(&before);
+    alloc_stats_mark();
+    double start;
+    init_time(&start);
+    bool ok = interpret_cmda(argc - 1, argv + 1);
+    double elapsed = delta_time(&start);
+    alloc_stats(&stats);
+
+    size_t allocs = stats.allocs - before.allocs;
+    report(1,
+           "%s: %lu allocations (%lu bytes), %lu frees (%lu bytes), %lu "
+           "failed in %.3f s: %.0f allocations/s",
+           argv[1], allocs, stats.alloc_bytes - before.alloc_bytes,
+           stats.frees - before.frees, stats.free_bytes - before.free_bytes,
+           stats.failed - before.failed, elapsed,
+           elapsed > 0 ? allocs / elapsed : 0);
+    if (stats.reallocs != before.reallocs)
+        report(1, "%lu blocks resized, %lu of them moved",
+               stats.reallocs - before.reallocs, stats.moves - before.moves);
+    report(1, "Live %+ld blocks, %+ld bytes; peak %lu bytes above start",
+           (long) stats.live_blocks - (long) before.live_blocks,
+           (long) stats.live_bytes - (long) before.live_bytes,
+           stats.mark_peak_bytes - before.live_bytes);
+    memstat_classes(&stats, &before);
+    return ok;
+}
+
+static bool do_budget(int argc, char *argv[])
+{
+    double limit;
+    double spent = time_limit_spent(&limit);
+    if (argc == 1) {
+        if (limit > 0)
+            report(1, "%.3f ms spent in commands, each allowed %.3f ms",
+                   spent * 1e3, limit * 1e3);
+        else
+            report(1, "%.3f ms spent in commands, with no limit", spent * 1e3);
+        return true;
+    }
+
+    /* Time the command given as arguments */
+    bool ok = interpret_cmda(argc - 1, argv + 1);
+    double used = time_limit_spent(NULL) - spent;
+    if (limit > 0)
+        report(1, "%s: used %.3f ms of %.3f ms, %.3f ms left", argv[1],
+               used * 1e3, limit * 1e3, (limit - used) * 1e3);
+    else
+        report(1, "%s: used %.3f ms, with no limit", argv[1], used * 1e3);
+    return ok;
+}
 
 static bool is_circular()
 {
@@ -902,11 +2148,11 @@ static bool is_circular()
 
 static bool q_show(int vlevel)
 {
-    bool ok = true;
+    volatile bool ok = true;
     if (verblevel < vlevel)
         return true;
 
-    int cnt = 0;
+    volatile int cnt = 0;
     if (!current || !current->q) {
         report(vlevel, "l = NULL");
         return true;
@@ -920,17 +2166,19 @@ static bool q_show(int vlevel)
     report_noreturn(vlevel, "l = [");
 
     struct list_head *ori = current->q;
-    struct list_head *cur = current->q->next;
+    struct list_head *volatile cur = current->q->next;
 
-    if (exception_setup(true)) {
+    exception_try(true) {
         while (ok && ori != cur && cnt < current->size) {
             element_t *e = list_entry(cur, element_t, list);
             if (cnt < BIG_LIST_SIZE) {
-                report_noreturn(vlevel, cnt == 0 ? "%s" : " %s", e->value);
+                size_t len = value_len(e);
+                report_noreturn(vlevel, cnt == 0 ? "%.*s" : " %.*s",
+                                (int) len, e->value);
                 if (show_entropy) {
                     report_noreturn(
                         vlevel, "(%3.2f%%)",
-                        shannon_entropy((const uint8_t *) e->value));
+                        shannon_entropy((const uint8_t *) e->value, len));
                 }
             }
             cnt++;
@@ -1018,6 +2266,228 @@ static bool do_next(int argc, char *argv[])
 
     return q_show(0);
 }
+static int pq_order(const element_t *a, const element_t *b)
+{
+    return pq->mode == Q_KEY_NUMERIC ? q_cmp_numeric(NULL, a, b)
+                                     : q_cmp_string(NULL, a, b);
+}
+
+/* Anything but a pop may bring in a smaller value */
+static void pq_forget_last()
+{
+    if (pq_last) {
+        q_release_element(pq_last);
+        pq_last = NULL;
+    }
+}
+
+static void pq_show(int vlevel)
+{
+    if (!pq)
+        report(vlevel, "pq = NULL");
+    else if (!pq->root)
+        report(vlevel, "pq = [], size = 0");
+    else
+        report(vlevel, "pq = [%s ...], size = %d", pq_min(pq)->value,
+               pq->size);
+}
+
+static bool do_pqpush(int argc, char *argv[])
+{
+    char randstr_buf[MAX_RANDSTR_LEN];
+    int reps = 1;
+    if ((argc != 2 && argc != 3) ||
+        (argc == 3 && (!get_int(argv[2], &reps) || reps < 0))) {
+        report(1, "%s needs a string and an optional count", argv[0]);
+        return false;
+    }
+
+    bool need_rand = !strcmp(argv[1], "RAND");
+    char *inserts = need_rand ? randstr_buf : argv[1];
+    if (!pq)
+        pq = pq_new(numeric ? Q_KEY_NUMERIC : Q_KEY_STRING);
+    if (!pq) {
+        report(1, "ERROR: Could not allocate priority queue");
+        return false;
+    }
+    pq_forget_last();
+    error_check();
+
+    volatile bool ok = true;
+    exception_try(true) {
+        for (int r = 0; ok && r < reps; r++) {
+            if (need_rand)
+                fill_rand_key(randstr_buf, sizeof(randstr_buf),
+                              pq->mode == Q_KEY_NUMERIC);
+            pq_node_t *node = pq_push(pq, inserts);
+            if (!node) {
+                fail_count++;
+                if (fail_count < fail_limit)
+                    report(2, "Push of %s failed", inserts);
+                else {
+                    report(1, "ERROR: Push of %s failed (%d failures total)",
+                           inserts, fail_count);
+                    ok = false;
+                }
+            } else if (node->elem.value == inserts) {
+                report(1, "ERROR: Need to allocate and copy pushed string");
+                ok = false;
+            }
+            ok = ok && !error_check();
+        }
+    }
+    exception_cancel();
+
+    pq_show(3);
+    return ok;
+}
+
+static bool do_pqpop(int argc, char *argv[])
+{
+    if (argc != 1 && argc != 2) {
+        report(1, "%s needs 0-1 arguments", argv[0]);
+        return false;
+    }
+
+    if (!pq || !pq->root)
+        report(3, "Warning: Calling pop on empty priority queue");
+    error_check();
+
+    element_t *e = NULL;
+    exception_try(true)
+        e = pq_pop_min(pq);
+    exception_cancel();
+
+    bool ok = true;
+    if (!e) {
+        fail_count++;
+        if (argc == 1 && fail_count < fail_limit) {
+            report(2, "Pop from priority queue failed");
+        } else {
+            report(1,
+                   "ERROR: Pop from priority queue failed (%d failures total)",
+                   fail_count);
+            ok = false;
+        }
+    } else {
+        report(2, "Removed %s from priority queue", e->value);
+        if (pq_last && pq_order(pq_last, e) > 0) {
+            report(1, "ERROR: Popped %s after %s", e->value, pq_last->value);
+            ok = false;
+        }
+        if (argc == 2 && strcmp(e->value, argv[1])) {
+            report(1, "ERROR: Removed value %s != expected value %s", e->value,
+                   argv[1]);
+            ok = false;
+        }
+        pq_forget_last();
+        pq_last = e;
+    }
+
+    pq_show(3);
+    return ok && !error_check();
+}
+
+static bool do_pqdec(int argc, char *argv[])
+{
+    if (argc != 3) {
+        report(1, "%s needs a value and its new value", argv[0]);
+        return false;
+    }
+
+    pq_node_t *node = NULL;
+    exception_try(true)
+        node = pq_find(pq, argv[1]);
+    exception_cancel();
+    if (!node) {
+        report(1, "ERROR: No %s in priority queue", argv[1]);
+        return false;
+    }
+    pq_forget_last();
+    error_check();
+
+    bool ok = false;
+    exception_try(true)
+        ok = pq_decrease_key(pq, node, argv[2]);
+    exception_cancel();
+
+    if (ok) {
+        report(2, "Decreased %s to %s", argv[1], argv[2]);
+    } else {
+        element_t e = {.value = argv[2], .len = strlen(argv[2])};
+        if (pq->mode == Q_KEY_NUMERIC)
+            e.key = strtoll(argv[2], NULL, 10);
+        if (pq_order(&e, &node->elem) > 0) {
+            report(2, "Kept %s, %s orders after it", argv[1], argv[2]);
+            ok = true;
+        } else if (++fail_count < fail_limit) {
+            report(2, "Decrease of %s failed", argv[1]);
+            ok = true;
+        } else {
+            report(1, "ERROR: Decrease of %s failed (%d failures total)",
+                   argv[1], fail_count);
+        }
+    }
+
+    pq_show(3);
+    return ok && !error_check();
+}
+
+static bool do_pqmeld(int argc, char *argv[])
+{
+    int n = 0;
+    if (argc != 2 || !get_int(argv[1], &n) || n < 0) {
+        report(1, "%s needs a number of random values", argv[0]);
+        return false;
+    }
+    if (!pq) {
+        report(3, "Warning: Calling meld on null priority queue");
+        return false;
+    }
+    pq_forget_last();
+    error_check();
+
+    volatile bool ok = false;
+    exception_try(true) {
+        char randstr_buf[MAX_RANDSTR_LEN];
+        pq_t *other = pq_new(pq->mode);
+        ok = other != NULL;
+        for (int i = 0; ok && i < n; i++) {
+            fill_rand_key(randstr_buf, sizeof(randstr_buf),
+                          pq->mode == Q_KEY_NUMERIC);
+            ok = pq_push(other, randstr_buf) != NULL;
+        }
+        if (ok) {
+            pq_meld(pq, other);
+            ok = !other->root && !other->size;
+        }
+        pq_free(other);
+    }
+    exception_cancel();
+
+    if (!ok)
+        report(1, "ERROR: Melding %d values failed", n);
+    pq_show(3);
+    return ok && !error_check();
+}
+
+static bool do_pqfree(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+    exception_try(true) {
+        pq_forget_last();
+        pq_free(pq);
+        pq = NULL;
+    }
+    exception_cancel();
+
+    pq_show(3);
+    return !error_check();
+}
+
 // static bool do_shuffle(int argc, char *argv[])
 // {
 //     if (argc != 1) {
@@ -1031,7 +2501,7 @@ static bool do_next(int argc, char *argv[])
 //     }
 //     error_check();
 //     set_noallocate_mode(true);
-//     if (exception_setup(true))
+//     exception_try(true)
 //         q_shuffle(current->q);
 //     exception_cancel();
 
@@ -1047,6 +2517,71 @@ static bool do_ttt(int argc, char *argv[])
     return true;
 }
 
+/* Switch the current queue along with the option */
+static void set_deferfree(int oldval)
+{
+    set_deferred_free_mode(deferfree);
+}
+
+static void set_indexed(int oldval)
+{
+    if (current && !q_set_index(current->q, indexed))
+        report(1, "ERROR: Could not index current queue");
+}
+
+static void set_counted(int oldval)
+{
+    if (current)
+        q_set_counted(current->q, counted);
+}
+
+static void set_filter(int oldval)
+{
+    if (filter < 0 || filter >= 1000) {
+        report(1, "ERROR: Filter false positive rate must be 0-999 per mille");
+        filter = oldval;
+        return;
+    }
+    if (current && !q_set_filter(current->q, filter / 1000.0))
+        report(1, "ERROR: Could not attach filter to current queue");
+}
+
+static void set_sitedepth(int oldval)
+{
+    if (sitedepth < 1 || sitedepth > ALLOC_SITE_DEPTH) {
+        report(1, "ERROR: Site depth must be 1-%d", ALLOC_SITE_DEPTH);
+        sitedepth = oldval;
+        return;
+    }
+    set_alloc_site_depth(sitedepth);
+}
+
+static void set_sample(int oldval)
+{
+    if (sample < 1) {
+        report(1, "ERROR: Sampling rate must be at least 1");
+        sample = oldval;
+        return;
+    }
+    set_sample_rate(sample);
+}
+
+static void set_budget(int oldval)
+{
+    if (budget < 0) {
+        report(1, "ERROR: Time budget must not be negative");
+        budget = oldval;
+        return;
+    }
+    set_time_limit(budget);
+}
+
+static void set_numeric(int oldval)
+{
+    if (current)
+        q_set_key_mode(current->q, numeric ? Q_KEY_NUMERIC : Q_KEY_STRING);
+}
+
 static void console_init()
 {
     ADD_COMMAND(new, "Create new queue", "");
@@ -1069,13 +2604,48 @@ static void console_init()
         rt,
         "Remove from tail of queue. Optionally compare to expected value str",
         "[str]");
+    ADD_COMMAND(clone,
+                "Duplicate queue, sharing strings until they are modified",
+                "");
+    ADD_COMMAND(upcase,
+                "Convert strings to upper case, copying shared strings first",
+                "");
     ADD_COMMAND(reverse, "Reverse queue", "");
     ADD_COMMAND(sort, "Sort queue in ascending/descening order", "");
+    ADD_COMMAND(sortby,
+                "Sort queue in ascending order of string, numeric, casefold "
+                "or length",
+                "order");
+    ADD_COMMAND(topk,
+                "Move the k smallest (largest with descend) elements to the "
+                "front in order",
+                "k");
+    ADD_COMMAND(nth,
+                "Place the element of rank n where sorting would put it. "
+                "Optionally compare to expected value str",
+                "n [str]");
     ADD_COMMAND(size, "Compute queue size n times (default: n == 1)", "[n]");
     ADD_COMMAND(show, "Show queue contents", "");
     ADD_COMMAND(dm, "Delete middle node in queue", "");
     ADD_COMMAND(dedup, "Delete all nodes that have duplicate string", "");
+    ADD_COMMAND(contains, "Check whether queue holds value str", "str");
+    ADD_COMMAND(delval, "Delete all nodes holding value str", "str");
+    ADD_COMMAND(filter, "Show size and accuracy of queue filter", "");
+    ADD_COMMAND(freeze,
+                "Move the sorted queue into front-coded storage and report "
+                "the memory saved",
+                "");
+    ADD_COMMAND(thaw, "Move the frozen queue back to the current queue", "");
+    ADD_COMMAND(ffind, "Search the frozen queue for value str", "str");
     ADD_COMMAND(merge, "Merge all the queues into one sorted queue", "");
+    ADD_COMMAND(mergeby,
+                "Merge all the queues, sorted in ascending order of string, "
+                "numeric, casefold or length, into one",
+                "order");
+    ADD_COMMAND(mergein,
+                "Merge the sorted current queue into the sorted queue before "
+                "it and free the current queue",
+                "");
     ADD_COMMAND(swap, "Swap every two adjacent nodes in queue", "");
     ADD_COMMAND(ascend,
                 "Remove every node which has a node with a strictly less "
@@ -1087,7 +2657,35 @@ static void console_init()
                 "");
     ADD_COMMAND(reverseK, "Reverse the nodes of the queue 'K' at a time",
                 "[K]");
+    ADD_COMMAND(pqpush,
+                "Push string str to priority queue n times. Generate random "
+                "string(s) if str equals RAND. (default: n == 1)",
+                "str [n]");
+    ADD_COMMAND(pqpop,
+                "Pop minimum of priority queue. Optionally compare to "
+                "expected value str",
+                "[str]");
+    ADD_COMMAND(pqdec, "Decrease value str in priority queue to newstr",
+                "str newstr");
+    ADD_COMMAND(pqmeld,
+                "Meld a priority queue of n random values into priority queue",
+                "n");
+    ADD_COMMAND(pqfree, "Delete priority queue", "");
     // ADD_COMMAND(shuffle, "Implement Fisher–Yates shuffle algorithm", "");
+    ADD_COMMAND(typed,
+                "Sort and merge n random payloads of a typed queue, where "
+                "type is int64 or record",
+                "type n");
+    ADD_COMMAND(memstat,
+                "Show allocation counts since start, or made by command cmd "
+                "with arguments args",
+                "[cmd args]");
+    ADD_COMMAND(memsites, "Show the n sites making most allocations",
+                "[n]");
+    ADD_COMMAND(budget,
+                "Show time spent in commands, or used by command cmd with "
+                "arguments args and left of its budget",
+                "[cmd args]");
     ADD_COMMAND(ttt, "play tic-tac-toe", "");
     add_param("length", &string_length, "Maximum length of displayed string",
               NULL);
@@ -1098,6 +2696,40 @@ static void console_init()
     add_param("descend", &descend,
               "Sort and merge queue in ascending/descending order", NULL);
     add_param("mode", &mode, "negamax vs. player or negamax vs. mcts", NULL);
+    add_param("deferfree", &deferfree,
+              "Free queues on a background thread, waiting for it only when "
+              "checking for leaks",
+              set_deferfree);
+    add_param("sortmem", &sortmem,
+              "Memory budget of sort in KiB, spilling runs to temporary files "
+              "(0: sort in memory)",
+              NULL);
+    add_param("index", &indexed,
+              "Keep a hash index of values in current and new queues",
+              set_indexed);
+    add_param("counted", &counted,
+              "Keep count of elements in current and new queues, sizing them "
+              "in O(1) time",
+              set_counted);
+    add_param("filter", &filter,
+              "False positive rate in per mille of a Bloom filter on current "
+              "and new queues (0: no filter)",
+              set_filter);
+    add_param("sitedepth", &sitedepth,
+              "Frames telling allocation sites apart, naming callers of "
+              "allocating functions",
+              set_sitedepth);
+    add_param("sample", &sample,
+              "Check one allocated block in n fully, only the header of the "
+              "others (1: check all)",
+              set_sample);
+    add_param("budget", &budget,
+              "Time limit of commands in microseconds, past which they are "
+              "aborted (0: no limit)",
+              set_budget);
+    add_param("numeric", &numeric,
+              "Order current and new queues by numeric key instead of string",
+              set_numeric);
 }
 
 /* Signal handlers */
@@ -1122,6 +2754,7 @@ static void sigalrm_handler(int sig)
 static void q_init()
 {
     fail_count = 0;
+    init_time(&memstat_start);
     INIT_LIST_HEAD(&chain.head);
     signal(SIGSEGV, sigsegv_handler);
     signal(SIGALRM, sigalrm_handler);
@@ -1130,10 +2763,7 @@ static void q_init()
 static bool q_quit(int argc, char *argv[])
 {
     report(3, "Freeing queue");
-    if (current && current->size > BIG_LIST_SIZE)
-        set_cautious_mode(false);
-
-    if (exception_setup(true)) {
+    exception_try(true) {
         struct list_head *cur = chain.head.next;
         while (chain.size > 0) {
             queue_contex_t *qctx = list_entry(cur, queue_contex_t, chain);
@@ -1142,18 +2772,31 @@ static bool q_quit(int argc, char *argv[])
             free(qctx);
             chain.size--;
         }
+        pq_forget_last();
+        pq_free(pq);
+        pq = NULL;
+        q_frozen_free(frozen);
+        frozen = NULL;
     }
 
     exception_cancel();
-    set_cautious_mode(true);
 
     size_t bcnt = allocation_check();
     if (bcnt > 0) {
         report(1, "ERROR: Freed queue, but %lu blocks are still allocated",
                bcnt);
+        report_leaks();
         return false;
     }
 
+    size_t reclaimed;
+    double seconds;
+    reclaim_stats(&reclaimed, &seconds);
+    if (reclaimed)
+        report(1,
+               "Reclaimed %lu blocks in background in %.3f s (%.0f blocks/s)",
+               reclaimed, seconds, seconds > 0 ? reclaimed / seconds : 0);
+
     return true;
 }
 
@@ -1275,6 +2918,10 @@ int main(int argc, char *argv[])
     init_cmd();
     console_init();
 
+    /* Set by "make valgrind": time limits do not hold at its speed */
+    if (getenv("QTEST_NO_TIMEOUT"))
+        disable_timeouts();
+
     /* Initialize linenoise only when infile_name not exist */
     if (!infile_name) {
         /* Trigger call back function(auto completion) */
@@ -1,8 +1,10 @@
 #include "queue.h"
+#include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h> /* strcasecmp */
 #include <time.h>
 
 /* Notice: sometimes, Cppcheck would find the potential NULL pointer bugs,
@@ -12,28 +14,696 @@
  */
 
 
+/* Slot of the hash index, empty when ele is NULL */
+typedef struct {
+    uint64_t hash;
+    element_t *ele;
+} index_slot_t;
+
+/* Open-addressing hash index from values to the elements holding them.
+ * Slots are probed linearly. Duplicates occupy several slots of the same
+ * cluster, and a deletion shifts the rest of its cluster back instead of
+ * leaving a tombstone.
+ */
+typedef struct {
+    index_slot_t *slots;
+    size_t mask; /* number of slots - 1, a power of 2 */
+    size_t count;
+} q_index_t;
+
+#define INDEX_MIN_SLOTS 16
+
+/* Counting Bloom filter over the values of a queue, with 4-bit counters packed
+ * two per byte. A value can only be queued if all the counters it hashes to
+ * are non-zero. Counters stick at their maximum, so an overflow can only cause
+ * false positives.
+ */
+typedef struct {
+    uint8_t *counters;
+    size_t size;     /* number of counters */
+    size_t capacity; /* elements the size is computed for */
+    size_t count;
+    double fp_rate; /* false positive rate aimed at */
+    int hashes;
+} q_filter_t;
+
+#define FILTER_MIN_CAPACITY 1024
+#define FILTER_MAX_COUNT 15
+#define FILTER_MAX_HASHES 16
+
+/* Per-queue state. q_new() hands out &head, so every queue passed to the
+ * q_* functions is embedded in a queue_t.
+ */
+typedef struct {
+    struct list_head head;
+    q_key_mode_t key_mode;
+    q_index_t *index;   /* NULL unless enabled by q_set_index() */
+    q_filter_t *filter; /* NULL unless enabled by q_set_filter() */
+    int count;          /* -1 unless enabled by q_set_counted() */
+} queue_t;
+
+static inline queue_t *queue_of(struct list_head *head)
+{
+    return container_of(head, queue_t, head);
+}
+
+static inline bool is_numeric(struct list_head *head)
+{
+    return queue_of(head)->key_mode == Q_KEY_NUMERIC;
+}
+
+/* Parse the numeric key of a value once, when it enters a numeric queue */
+static inline int64_t parse_key(const char *s)
+{
+    return strtoll(s, NULL, 10);
+}
+
+/* Order two elements by their cached key or by their string */
+static inline int cmp_element(const element_t *a,
+                              const element_t *b,
+                              bool numeric)
+{
+    if (numeric)
+        return (a->key > b->key) - (a->key < b->key);
+    return strcmp(a->value, b->value);
+}
+
+/* Are the values of two elements equal? Lengths differ for most pairs of
+ * distinct strings, which settles them without touching the strings.
+ */
+static inline bool equal_element(const element_t *a,
+                                 const element_t *b,
+                                 bool numeric)
+{
+    if (numeric)
+        return a->key == b->key;
+    /* Clones share values, equal pointers need no comparison */
+    return a->len == b->len &&
+           (a->value == b->value ||
+            !memcmp(a->value, b->value, a->len));
+}
+
+/* Copy the value of an element into a buffer of bufsize bytes, truncating
+ * it to bufsize - 1 characters plus a null terminator
+ */
+static inline void copy_value(char *sp, const element_t *e, size_t bufsize)
+{
+    size_t n = e->len < bufsize - 1 ? e->len : bufsize - 1;
+    memcpy(sp, e->value, n);
+    sp[n] = '\0';
+}
+
+/* Values are shared between clones of a queue. The reference count of a
+ * value is stored right after its terminator, aligned, so that value still
+ * points to the start of its allocation. Counts are updated atomically since
+ * clones may be released from another thread.
+ */
+typedef uint32_t refcount_t;
+
+/* Offset of the reference count: past the terminator, rounded up */
+static inline size_t value_ref_offset(size_t len)
+{
+    return (len + sizeof(refcount_t)) & ~(sizeof(refcount_t) - 1);
+}
+
+static inline refcount_t *value_ref(const char *value, size_t len)
+{
+    return (refcount_t *) (value + value_ref_offset(len));
+}
+
+/* Allocate an unshared copy of the first len bytes of s */
+static char *value_alloc(const char *s, size_t len)
+{
+    char *value = malloc(value_ref_offset(len) + sizeof(refcount_t));
+    if (!value)
+        return NULL;
+    memcpy(value, s, len);
+    value[len] = '\0';
+    *value_ref(value, len) = 1;
+    return value;
+}
+
+/* Drop a reference to a value, freeing it with the last one */
+void q_value_put(char *value, size_t len)
+{
+    if (!value)
+        return;
+    refcount_t *ref = value_ref(value, len);
+    /* An unshared value cannot gain references concurrently */
+    if (__atomic_load_n(ref, __ATOMIC_ACQUIRE) == 1 ||
+        !__atomic_sub_fetch(ref, 1, __ATOMIC_ACQ_REL))
+        free(value);
+}
+
+/* Get a value which can be modified without affecting other queues */
+char *q_value_writable(element_t *e)
+{
+    if (!e)
+        return NULL;
+    refcount_t *ref = value_ref(e->value, e->len);
+    if (__atomic_load_n(ref, __ATOMIC_ACQUIRE) == 1)
+        return e->value;
+    char *copy = value_alloc(e->value, e->len);
+    if (!copy)
+        return NULL;
+    q_value_put(e->value, e->len);
+    e->value = copy;
+    return copy;
+}
+
+/* Store a copy of a string in an element */
+bool q_element_set(element_t *e, const char *s, q_key_mode_t mode)
+{
+    size_t len = strlen(s);
+    char *value = value_alloc(s, len);
+    if (!value)
+        return false;
+    e->value = value;
+    e->len = len;
+    e->key = mode == Q_KEY_NUMERIC ? parse_key(value) : 0;
+    return true;
+}
+
+/* Hash a value so that equal elements in the given key mode collide */
+static uint64_t hash_element(const element_t *e, bool numeric)
+{
+    uint64_t h;
+    if (numeric) {
+        h = (uint64_t) e->key;
+    } else {
+        /* FNV-1a */
+        h = 14695981039346656037ULL;
+        for (size_t i = 0; i < e->len; i++) {
+            h ^= (unsigned char) e->value[i];
+            h *= 1099511628211ULL;
+        }
+    }
+    /* Finalizer of splitmix64, spreads the entropy over the low bits */
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+/* Move the entries of an index to a new array of @slots slots */
+static bool index_resize(q_index_t *idx, size_t slots)
+{
+    index_slot_t *new_slots = malloc(slots * sizeof(index_slot_t));
+    if (!new_slots)
+        return false;
+    memset(new_slots, 0, slots * sizeof(index_slot_t));
+    if (idx->slots) {
+        for (size_t i = 0; i <= idx->mask; i++) {
+            if (!idx->slots[i].ele)
+                continue;
+            size_t j = idx->slots[i].hash & (slots - 1);
+            while (new_slots[j].ele)
+                j = (j + 1) & (slots - 1);
+            new_slots[j] = idx->slots[i];
+        }
+        free(idx->slots);
+    }
+    idx->slots = new_slots;
+    idx->mask = slots - 1;
+    return true;
+}
+
+static void index_drop(queue_t *q)
+{
+    if (!q->index)
+        return;
+    free(q->index->slots);
+    free(q->index);
+    q->index = NULL;
+}
+
+/* Add an element which has just entered queue @q to its index */
+static void index_add(queue_t *q, element_t *e, uint64_t h)
+{
+    q_index_t *idx = q->index;
+    if (!idx)
+        return;
+    /* Keep the load factor at most 3/4 */
+    if ((idx->count + 1) * 4 > (idx->mask + 1) * 3 &&
+        !index_resize(idx, (idx->mask + 1) * 2)) {
+        /* The index only speeds up lookups, which fall back to a scan */
+        index_drop(q);
+        return;
+    }
+    size_t i = h & idx->mask;
+    while (idx->slots[i].ele)
+        i = (i + 1) & idx->mask;
+    idx->slots[i].hash = h;
+    idx->slots[i].ele = e;
+    idx->count++;
+}
+
+/* Remove an element which is leaving queue @q from its index */
+static void index_del(queue_t *q, element_t *e, uint64_t h)
+{
+    q_index_t *idx = q->index;
+    if (!idx)
+        return;
+    size_t i = h & idx->mask;
+    while (idx->slots[i].ele != e) {
+        if (!idx->slots[i].ele)
+            return;
+        i = (i + 1) & idx->mask;
+    }
+    /* Shift back the entries after the hole which may move to it, that is
+     * those whose home slot is not between the hole and themselves
+     */
+    for (size_t j = (i + 1) & idx->mask; idx->slots[j].ele;
+         j = (j + 1) & idx->mask) {
+        size_t home = idx->slots[j].hash & idx->mask;
+        if (((j - home) & idx->mask) >= ((j - i) & idx->mask)) {
+            idx->slots[i] = idx->slots[j];
+            i = j;
+        }
+    }
+    idx->slots[i].ele = NULL;
+    idx->count--;
+}
+
+/* Count up to @limit indexed elements equal to @key, storing the first one */
+static size_t index_match(const queue_t *q,
+                          const element_t *key,
+                          size_t limit,
+                          element_t **first)
+{
+    const q_index_t *idx = q->index;
+    bool numeric = q->key_mode == Q_KEY_NUMERIC;
+    uint64_t h = hash_element(key, numeric);
+    size_t n = 0;
+    for (size_t i = h & idx->mask; idx->slots[i].ele && n < limit;
+         i = (i + 1) & idx->mask) {
+        const index_slot_t *slot = &idx->slots[i];
+        if (slot->hash != h || !equal_element(slot->ele, key, numeric))
+            continue;
+        if (!n++ && first)
+            *first = slot->ele;
+    }
+    return n;
+}
+
+/* Position of the i-th counter of a hash: double hashing, mapped onto the
+ * counters by a multiplication instead of a division
+ */
+static inline size_t filter_pos(const q_filter_t *f, uint64_t h, int i)
+{
+    uint64_t g = h + i * ((h >> 32 | h << 32) | 1);
+    return (size_t) (((__uint128_t) g * f->size) >> 64);
+}
+
+static inline unsigned filter_get(const q_filter_t *f, size_t pos)
+{
+    return (f->counters[pos >> 1] >> ((pos & 1) * 4)) & 0xf;
+}
+
+/* Add @delta, 1 or -1, to the counters of a hash */
+static void filter_count(q_filter_t *f, uint64_t h, int delta)
+{
+    for (int i = 0; i < f->hashes; i++) {
+        size_t pos = filter_pos(f, h, i);
+        unsigned c = filter_get(f, pos);
+        if (c == FILTER_MAX_COUNT || (delta < 0 && !c))
+            continue;
+        f->counters[pos >> 1] += delta * (1 << ((pos & 1) * 4));
+    }
+}
+
+/* Smallest counter of a hash, at least the number of copies of its value */
+static unsigned filter_min(const q_filter_t *f, uint64_t h)
+{
+    unsigned min = FILTER_MAX_COUNT;
+    for (int i = 0; i < f->hashes && min; i++) {
+        unsigned c = filter_get(f, filter_pos(f, h, i));
+        if (c < min)
+            min = c;
+    }
+    return min;
+}
+
+static void filter_drop(queue_t *q)
+{
+    if (!q->filter)
+        return;
+    free(q->filter->counters);
+    free(q->filter);
+    q->filter = NULL;
+}
+
+/* Size the filter of @q for @capacity elements, then count the elements of
+ * @q and those of @extra, which are about to join it. The filter is dropped if
+ * allocation fails.
+ */
+static bool filter_build(queue_t *q, size_t capacity, struct list_head *extra)
+{
+    q_filter_t *f = q->filter;
+    /* -ln(p) / ln(2)^2 counters per element and ln(2) times as many hashes
+     * minimize the false positive rate p
+     */
+    double per_element = -log(f->fp_rate) / (M_LN2 * M_LN2);
+    int hashes = (int) (per_element * M_LN2 + 0.5);
+    f->hashes = hashes < 1                   ? 1
+                : hashes > FILTER_MAX_HASHES ? FILTER_MAX_HASHES
+                                             : hashes;
+    f->size = (size_t) (capacity * per_element) + 1;
+    f->capacity = capacity;
+    f->count = 0;
+    /* Free first, a large filter should not be held twice */
+    free(f->counters);
+    f->counters = malloc((f->size + 1) / 2);
+    if (!f->counters) {
+        free(f);
+        q->filter = NULL;
+        return false;
+    }
+    memset(f->counters, 0, (f->size + 1) / 2);
+
+    bool numeric = q->key_mode == Q_KEY_NUMERIC;
+    struct list_head *lists[] = {&q->head, extra};
+    for (int l = 0; l < 2 && lists[l]; l++) {
+        element_t *ele;
+        list_for_each_entry (ele, lists[l], list) {
+            filter_count(f, hash_element(ele, numeric), 1);
+            f->count++;
+        }
+    }
+    return true;
+}
+
+/* Count an element which has just entered queue @q in its filter */
+static void filter_add(queue_t *q, uint64_t h)
+{
+    q_filter_t *f = q->filter;
+    if (!f)
+        return;
+    /* Growing recounts the whole queue, which holds the new element */
+    if (f->count >= f->capacity) {
+        filter_build(q, f->capacity * 2, NULL);
+        return;
+    }
+    filter_count(f, h, 1);
+    f->count++;
+}
+
+static void filter_del(queue_t *q, uint64_t h)
+{
+    q_filter_t *f = q->filter;
+    if (!f)
+        return;
+    filter_count(f, h, -1);
+    f->count--;
+}
+
+/* Keep the count, the index and the filter of @q up to date with its
+ * elements
+ */
+static void member_add(queue_t *q, element_t *e)
+{
+    if (q->count >= 0)
+        q->count++;
+    if (q->index || q->filter) {
+        uint64_t h = hash_element(e, q->key_mode == Q_KEY_NUMERIC);
+        index_add(q, e, h);
+        filter_add(q, h);
+    }
+}
+
+static void member_del(queue_t *q, element_t *e)
+{
+    if (q->count >= 0)
+        q->count--;
+    if (q->index || q->filter) {
+        uint64_t h = hash_element(e, q->key_mode == Q_KEY_NUMERIC);
+        index_del(q, e, h);
+        filter_del(q, h);
+    }
+}
+
+/* Tell whether a value may be queued, as far as the filter of @q knows */
+static bool filter_may_hold(const queue_t *q, const element_t *key)
+{
+    return !q->filter ||
+           filter_min(q->filter,
+                      hash_element(key, q->key_mode == Q_KEY_NUMERIC));
+}
+
+/* Turn a string into an element which can be compared with queued ones */
+static element_t probe_element(struct list_head *head, const char *s)
+{
+    element_t key = {.value = (char *) s, .len = strlen(s)};
+    if (is_numeric(head))
+        key.key = parse_key(s);
+    return key;
+}
+
 /* Create an empty queue */
 struct list_head *q_new()
 {
-    struct list_head *new = malloc(sizeof(struct list_head));
-    if (!new)
+    queue_t *q = malloc(sizeof(queue_t));
+    if (!q)
         return NULL;
-    INIT_LIST_HEAD(new);
-    return new;
+    INIT_LIST_HEAD(&q->head);
+    q->key_mode = Q_KEY_STRING;
+    q->index = NULL;
+    q->filter = NULL;
+    q->count = -1;
+    return &q->head;
 }
 
-/* Free all storage used by queue */
-void q_free(struct list_head *l)
+/* Select how the elements of a queue are ordered */
+bool q_set_key_mode(struct list_head *head, q_key_mode_t mode)
 {
-    if (!l)
-        return;
+    if (!head)
+        return false;
+    queue_t *q = queue_of(head);
+    if (mode == Q_KEY_NUMERIC && q->key_mode != Q_KEY_NUMERIC) {
+        element_t *ele;
+        list_for_each_entry (ele, head, list)
+            ele->key = parse_key(ele->value);
+    }
+    bool changed = q->key_mode != mode;
+    q->key_mode = mode;
+    /* Values equal under one mode may differ under the other */
+    if (changed && q->index)
+        q_set_index(head, true);
+    if (changed && q->filter)
+        filter_build(q, q->filter->capacity, NULL);
+    return true;
+}
+
+/* Get the key mode of a queue */
+q_key_mode_t q_key_mode(struct list_head *head)
+{
+    return head ? queue_of(head)->key_mode : Q_KEY_STRING;
+}
+
+/* Build or drop the hash index of a queue */
+bool q_set_index(struct list_head *head, bool enable)
+{
+    if (!head)
+        return false;
+    queue_t *q = queue_of(head);
+    index_drop(q);
+    if (!enable)
+        return true;
+
+    q_index_t *idx = malloc(sizeof(q_index_t));
+    if (!idx)
+        return false;
+    idx->slots = NULL;
+    idx->count = 0;
+    size_t n = 0, slots = INDEX_MIN_SLOTS;
+    struct list_head *node;
+    list_for_each (node, head)
+        n++;
+    while (n * 4 > slots * 3)
+        slots <<= 1;
+    if (!index_resize(idx, slots)) {
+        free(idx);
+        return false;
+    }
+    q->index = idx;
+    bool numeric = q->key_mode == Q_KEY_NUMERIC;
+    element_t *ele;
+    list_for_each_entry (ele, head, list)
+        index_add(q, ele, hash_element(ele, numeric));
+    return true;
+}
+
+/* Tell whether a queue has a hash index */
+bool q_indexed(struct list_head *head)
+{
+    return head && queue_of(head)->index;
+}
+
+/* Start or stop keeping count of the elements of a queue */
+bool q_set_counted(struct list_head *head, bool enable)
+{
+    if (!head)
+        return false;
+    queue_t *q = queue_of(head);
+    q->count = -1;
+    if (enable)
+        q->count = q_size(head);
+    return true;
+}
+
+/* Tell whether a queue keeps count of its elements */
+bool q_counted(struct list_head *head)
+{
+    return head && queue_of(head)->count >= 0;
+}
+
+/* Attach or drop a counting Bloom filter */
+bool q_set_filter(struct list_head *head, double fp_rate)
+{
+    if (!head)
+        return false;
+    queue_t *q = queue_of(head);
+    filter_drop(q);
+    if (!(fp_rate > 0 && fp_rate < 1))
+        return true;
+
+    q_filter_t *f = malloc(sizeof(q_filter_t));
+    if (!f)
+        return false;
+    f->counters = NULL;
+    f->fp_rate = fp_rate;
+    size_t n = 0;
+    struct list_head *node;
+    list_for_each (node, head)
+        n++;
+    q->filter = f;
+    return filter_build(q, n > FILTER_MIN_CAPACITY ? n : FILTER_MIN_CAPACITY,
+                        NULL);
+}
+
+/* Report the size and accuracy of the filter of a queue */
+bool q_filter_stats(struct list_head *head, q_filter_stats_t *stats)
+{
+    if (!head || !queue_of(head)->filter)
+        return false;
+    if (!stats)
+        return true;
+    const q_filter_t *f = queue_of(head)->filter;
+    size_t used = 0;
+    for (size_t i = 0; i < f->size; i++)
+        used += filter_get(f, i) != 0;
+    stats->bytes = sizeof(q_filter_t) + (f->size + 1) / 2;
+    stats->counters = f->size;
+    stats->hashes = f->hashes;
+    stats->count = f->count;
+    stats->capacity = f->capacity;
+    stats->fp_target = f->fp_rate;
+    /* A missing value passes if all its counters are among the used ones */
+    stats->fp_estimate = pow((double) used / f->size, f->hashes);
+    return true;
+}
+
+/* Tell whether a queue holds a value */
+bool q_contains(struct list_head *head, const char *s)
+{
+    if (!head || !s)
+        return false;
+    element_t key = probe_element(head, s);
+    if (!filter_may_hold(queue_of(head), &key))
+        return false;
+    if (queue_of(head)->index)
+        return index_match(queue_of(head), &key, 1, NULL) > 0;
+    bool numeric = is_numeric(head);
+    element_t *ele;
+    list_for_each_entry (ele, head, list) {
+        if (equal_element(ele, &key, numeric))
+            return true;
+    }
+    return false;
+}
+
+/* Delete every element holding a value */
+int q_delete_value(struct list_head *head, const char *s)
+{
+    if (!head || !s)
+        return 0;
+    queue_t *q = queue_of(head);
+    element_t key = probe_element(head, s);
+    int n = 0;
+    if (!filter_may_hold(q, &key))
+        return 0;
+    if (q->index) {
+        element_t *ele;
+        while (index_match(q, &key, 1, &ele)) {
+            member_del(q, ele);
+            list_del(&ele->list);
+            q_release_element(ele);
+            n++;
+        }
+        return n;
+    }
+    bool numeric = is_numeric(head);
+    element_t *ele, *safe;
+    list_for_each_entry_safe (ele, safe, head, list) {
+        if (equal_element(ele, &key, numeric)) {
+            list_del(&ele->list);
+            member_del(q, ele);
+            q_release_element(ele);
+            n++;
+        }
+    }
+    return n;
+}
+
+static void release_queue(void *arg)
+{
+    queue_t *q = arg;
     struct list_head *node, *next;
-    list_for_each_safe (node, next, l) {
+    list_for_each_safe (node, next, &q->head) {
         element_t *ele = container_of(node, element_t, list);
         if (ele)
             q_release_element(ele);
     }
-    free(l);
+    index_drop(q);
+    filter_drop(q);
+    free(q);
+}
+
+/* Free all storage used by queue */
+void q_free(struct list_head *l)
+{
+    if (!l)
+        return;
+    /* The queue is unreachable from now on, so it can be handed over whole
+     * to the reclaimer when freeing is deferred
+     */
+    if (!test_defer_free(release_queue, queue_of(l)))
+        release_queue(queue_of(l));
+}
+
+/* Duplicate a queue, sharing the values of its elements */
+struct list_head *q_clone(struct list_head *head)
+{
+    if (!head)
+        return NULL;
+    struct list_head *clone = q_new();
+    if (!clone)
+        return NULL;
+    queue_of(clone)->key_mode = queue_of(head)->key_mode;
+    element_t *ele;
+    list_for_each_entry (ele, head, list) {
+        element_t *copy = malloc(sizeof(element_t));
+        if (!copy) {
+            q_free(clone);
+            return NULL;
+        }
+        *copy = *ele;
+        __atomic_add_fetch(value_ref(ele->value, ele->len), 1,
+                           __ATOMIC_RELAXED);
+        list_add_tail(&copy->list, clone);
+    }
+    return clone;
 }
 
 /* Insert an element at head of queue */
@@ -44,16 +714,12 @@ bool q_insert_head(struct list_head *head, char *s)
     element_t *newNode = malloc(sizeof(element_t));
     if (!newNode)
         return false;
-    size_t len = strlen(s);
-    char *copyStr = malloc(len + 1);
-    if (!copyStr) {
+    if (!q_element_set(newNode, s, q_key_mode(head))) {
         free(newNode);
         return false;
     }
-    copyStr[len] = '\0';
-    strncpy(copyStr, s, len);
-    newNode->value = copyStr;
     list_add(&newNode->list, head);
+    member_add(queue_of(head), newNode);
     return true;
 }
 
@@ -65,18 +731,32 @@ bool q_insert_tail(struct list_head *head, char *s)
     element_t *newNode = malloc(sizeof(element_t));
     if (!newNode)
         return false;
+    if (!q_element_set(newNode, s, q_key_mode(head))) {
+        free(newNode);
+        return false;
+    }
+    list_add_tail(&newNode->list, head);
+    member_add(queue_of(head), newNode);
+    return true;
+}
 
-    size_t len = strlen(s);
-    char *copyStr = malloc(len + 1);
-
-    if (!copyStr) {
+/* Insert a copy of an element at tail of queue, reusing its length and key */
+bool q_insert_tail_copy(struct list_head *head, const element_t *e)
+{
+    if (!head)
+        return false;
+    element_t *newNode = malloc(sizeof(element_t));
+    if (!newNode)
+        return false;
+    newNode->value = value_alloc(e->value, e->len);
+    if (!newNode->value) {
         free(newNode);
         return false;
     }
-    copyStr[len] = '\0';
-    strncpy(copyStr, s, len);
-    newNode->value = copyStr;
+    newNode->len = e->len;
+    newNode->key = e->key;
     list_add_tail(&newNode->list, head);
+    member_add(queue_of(head), newNode);
     return true;
 }
 
@@ -88,11 +768,10 @@ element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize)
 
     element_t *rmElement = list_first_entry(head, element_t, list);
     list_del(&rmElement->list);
+    member_del(queue_of(head), rmElement);
 
-    if (sp && bufsize > 0) {
-        strncpy(sp, rmElement->value, bufsize - 1);
-        sp[bufsize - 1] = '\0';
-    }
+    if (sp && bufsize > 0)
+        copy_value(sp, rmElement, bufsize);
 
     return rmElement;
 }
@@ -105,11 +784,10 @@ element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize)
 
     element_t *rmElement = list_last_entry(head, element_t, list);
     list_del(&rmElement->list);
+    member_del(queue_of(head), rmElement);
 
-    if (sp && bufsize > 0) {
-        strncpy(sp, rmElement->value, bufsize - 1);
-        sp[bufsize - 1] = '\0';
-    }
+    if (sp && bufsize > 0)
+        copy_value(sp, rmElement, bufsize);
 
     return rmElement;
 }
@@ -119,6 +797,8 @@ int q_size(struct list_head *head)
 {
     if (!head)
         return 0;
+    if (queue_of(head)->count >= 0)
+        return queue_of(head)->count;
     int size = 0;
     struct list_head *node;
     list_for_each (node, head) {
@@ -143,6 +823,7 @@ bool q_delete_mid(struct list_head *head)
 
     element_t *rmElement = list_entry(slow, element_t, list);
     list_del_init(slow);
+    member_del(queue_of(head), rmElement);
     q_release_element(rmElement);
     return true;
 }
@@ -154,21 +835,43 @@ bool q_delete_dup(struct list_head *head)
 {
     if (!head)
         return false;
+    bool numeric = is_numeric(head);
     LIST_HEAD(dup_list);
     struct list_head *node, *next;
+    queue_t *q = queue_of(head);
+    if (q->index) {
+        /* Count the copies of every value in O(1), moving the duplicated
+         * ones aside until counting is done
+         */
+        list_for_each_safe (node, next, head) {
+            element_t *ele = list_entry(node, element_t, list);
+            if (index_match(q, ele, 2, NULL) > 1)
+                list_move_tail(node, &dup_list);
+        }
+        list_for_each_safe (node, next, &dup_list) {
+            element_t *ele = list_entry(node, element_t, list);
+            member_del(q, ele);
+            q_release_element(ele);
+        }
+        return true;
+    }
     list_for_each_safe (node, next, head) {
         struct list_head *cur = node->prev;
         bool isDup = false;
         element_t *ele1 = list_entry(node, element_t, list);
         if (!ele1)
             return false;
+        /* A counter of 1 proves the value unique, no need to look for it */
+        if (q->filter && filter_min(q->filter, hash_element(ele1, numeric)) < 2)
+            continue;
         while (cur != head) {
             element_t *ele2 = list_entry(cur, element_t, list);
             if (!ele2)
                 return false;
 
-            if (!strcmp(ele1->value, ele2->value)) {
+            if (equal_element(ele1, ele2, numeric)) {
                 list_del_init(node);
+                member_del(q, ele1);
                 q_release_element(ele1);
                 list_del_init(cur);
                 list_add_tail(cur, &dup_list);
@@ -183,8 +886,9 @@ bool q_delete_dup(struct list_head *head)
             element_t *ele2 = list_entry(cur, element_t, list);
             if (!ele2)
                 return false;
-            if (!strcmp(ele1->value, ele2->value)) {
+            if (equal_element(ele1, ele2, numeric)) {
                 list_del_init(node);
+                member_del(q, ele1);
                 q_release_element(ele1);
                 break;
             }
@@ -193,6 +897,7 @@ bool q_delete_dup(struct list_head *head)
     // delete duplicated list
     list_for_each_safe (node, next, &dup_list) {
         element_t *ele = list_entry(node, element_t, list);
+        member_del(q, ele);
         q_release_element(ele);
     }
     return true;
@@ -204,21 +909,10 @@ void q_swap(struct list_head *head)
 {
     if (!head || list_empty(head))
         return;
-    for (struct list_head *cur = head->next;
-         (uintptr_t) (cur) ^ (uintptr_t) (head) &&
-         (uintptr_t) (cur->next) ^ (uintptr_t) (head);
-         cur = cur->next->next) {
-        element_t *first = list_entry(cur, element_t, list);
-        element_t *second = list_entry(cur->next, element_t, list);
-        // swap the value
-        first->value =
-            (char *) ((uintptr_t) first->value ^ (uintptr_t) second->value);
-        second->value =
-            (char *) ((uintptr_t) first->value ^ (uintptr_t) second->value);
-        first->value =
-            (char *) ((uintptr_t) first->value ^ (uintptr_t) second->value);
-    }
-    return;
+    // relink the nodes so that value, length and key stay together
+    for (struct list_head *cur = head->next; cur != head && cur->next != head;
+         cur = cur->next)
+        list_move(cur, cur->next);
 }
 
 /* Reverse elements in queue */
@@ -247,26 +941,82 @@ void q_reverse(struct list_head *head)
 // https://leetcode.com/problems/reverse-nodes-in-k-group/
 void q_reverseK(struct list_head *head, int k)
 {
-    if (!head || list_empty(head))
+    if (!head || list_empty(head) || k < 2)
         return;
-    struct list_head *it, *safe, *cut;
-    int ctr = k;
-    cut = head;
-    list_for_each_safe (it, safe, head) {
-        if (--ctr)
-            continue;
-        LIST_HEAD(tmp);
-        list_cut_position(&tmp, cut, it);
-        q_reverse(&tmp);
-        list_splice(&tmp, cut);
-        cut = safe->prev;
-        ctr = k;
+    struct list_head *before = head;
+    for (;;) {
+        /* Swap the links of up to k nodes while walking the group once */
+        struct list_head *cur = before->next;
+        int n = 0;
+        for (; n < k && cur != head; n++) {
+            struct list_head *next = cur->next;
+            cur->next = cur->prev;
+            cur->prev = next;
+            cur = next;
+        }
+        if (n < k) {
+            /* The tail is shorter than k: swap its links back */
+            for (cur = before->next; n--; cur = cur->next) {
+                struct list_head *prev = cur->next;
+                cur->next = cur->prev;
+                cur->prev = prev;
+            }
+            return;
+        }
+        /* Attach the reversed group between before and cur */
+        struct list_head *first = before->next, *last = cur->prev;
+        before->next = last;
+        last->prev = before;
+        first->next = cur;
+        cur->prev = first;
+        before = first;
     }
 }
 
+int q_cmp_string(void *priv, const element_t *a, const element_t *b)
+{
+    return strcmp(a->value, b->value);
+}
+
+int q_cmp_numeric(void *priv, const element_t *a, const element_t *b)
+{
+    return (a->key > b->key) - (a->key < b->key);
+}
+
+int q_cmp_casefold(void *priv, const element_t *a, const element_t *b)
+{
+    return strcasecmp(a->value, b->value);
+}
+
+int q_cmp_length(void *priv, const element_t *a, const element_t *b)
+{
+    if (a->len != b->len)
+        return a->len < b->len ? -1 : 1;
+    return memcmp(a->value, b->value, a->len);
+}
+
+static int cmp_string_desc(void *priv, const element_t *a, const element_t *b)
+{
+    return strcmp(b->value, a->value);
+}
+
+static int cmp_numeric_desc(void *priv, const element_t *a, const element_t *b)
+{
+    return (b->key > a->key) - (b->key < a->key);
+}
+
+/* Comparator q_sort() and q_merge() use for the key mode of a queue */
+static q_cmp_func_t default_cmp(struct list_head *head, bool descend)
+{
+    if (is_numeric(head))
+        return descend ? cmp_numeric_desc : q_cmp_numeric;
+    return descend ? cmp_string_desc : q_cmp_string;
+}
+
 struct list_head *mergeTwoLists(struct list_head *L1,
                                 struct list_head *L2,
-                                bool descend)
+                                q_cmp_func_t cmp,
+                                void *priv)
 {
     if (!L1)
         return L2;
@@ -279,7 +1029,7 @@ struct list_head *mergeTwoLists(struct list_head *L1,
     while (L1 != L1_head && L2 != L2_head) {
         element_t *ele1 = list_entry(L1, element_t, list);
         element_t *ele2 = list_entry(L2, element_t, list);
-        if ((strcmp(ele1->value, ele2->value) <= 0) != descend) {
+        if (cmp(priv, ele1, ele2) <= 0) {
             struct list_head *next = L1->next;
             list_move_tail(L1, &head);
             L1 = next;
@@ -299,7 +1049,9 @@ struct list_head *mergeTwoLists(struct list_head *L1,
     return L1_head;
 }
 
-struct list_head *mergesort_list(struct list_head *head, bool descend)
+struct list_head *mergesort_list(struct list_head *head,
+                                 q_cmp_func_t cmp,
+                                 void *priv)
 {
     if (!head || list_empty(head) || list_is_singular(head)) {
         return head;
@@ -325,9 +1077,9 @@ struct list_head *mergesort_list(struct list_head *head, bool descend)
     prevmid->next = head;
     head->prev = prevmid;
 
-    struct list_head *left = mergesort_list(head, descend),
-                     *right = mergesort_list(head2, descend);
-    mergeTwoLists(left, right, descend);
+    struct list_head *left = mergesort_list(head, cmp, priv),
+                     *right = mergesort_list(head2, cmp, priv);
+    mergeTwoLists(left, right, cmp, priv);
     return left;
 }
 
@@ -336,7 +1088,146 @@ void q_sort(struct list_head *head, bool descend)
 {
     if (!head || list_empty(head))
         return;
-    mergesort_list(head, descend);
+    mergesort_list(head, default_cmp(head, descend), NULL);
+}
+
+/* Sort elements of queue with a custom comparator */
+void q_sort_by(struct list_head *head, q_cmp_func_t cmp, void *priv)
+{
+    if (!head || list_empty(head))
+        return;
+    mergesort_list(head, cmp, priv);
+}
+
+/* Move the first @k nodes of @from to the tail of @to, return how many moved */
+static int move_front(struct list_head *to, struct list_head *from, int k)
+{
+    int n = 0;
+    struct list_head *cut = from;
+    while (n < k && cut->next != from) {
+        cut = cut->next;
+        n++;
+    }
+    LIST_HEAD(tmp);
+    list_cut_position(&tmp, from, cut);
+    list_splice_tail(&tmp, to);
+    return n;
+}
+
+/* Keep the k best elements sorted at the front of queue */
+int q_topk(struct list_head *head, int k, bool descend)
+{
+    if (!head || list_empty(head) || k <= 0)
+        return 0;
+    q_cmp_func_t cmp = default_cmp(head, descend);
+    LIST_HEAD(top);
+    LIST_HEAD(rest);
+    int ntop = 0;
+
+    /* Candidates are gathered k at a time, sorted and merged into the top k.
+     * Once the top k is full, elements not better than its last one can never
+     * enter it and are set aside without being sorted. Ties lose to earlier
+     * elements, which keeps the result stable.
+     */
+    while (!list_empty(head)) {
+        LIST_HEAD(chunk);
+        if (ntop < k) {
+            move_front(&chunk, head, k);
+        } else {
+            element_t *last = list_last_entry(&top, element_t, list);
+            int n = 0;
+            while (n < k && !list_empty(head)) {
+                element_t *e = list_first_entry(head, element_t, list);
+                if (cmp(NULL, e, last) < 0) {
+                    list_move_tail(&e->list, &chunk);
+                    n++;
+                } else {
+                    list_move_tail(&e->list, &rest);
+                }
+            }
+            if (!n)
+                break;
+        }
+        mergesort_list(&chunk, cmp, NULL);
+        mergeTwoLists(&top, &chunk, cmp, NULL);
+
+        /* Drop whatever the merge pushed past the k-th place */
+        LIST_HEAD(keep);
+        ntop = move_front(&keep, &top, k);
+        list_splice_tail_init(&top, &rest);
+        list_splice(&keep, &top);
+    }
+    list_splice_tail(&rest, &top);
+    list_splice(&top, head);
+    return ntop;
+}
+
+/* Place the element of rank n where sorting would put it, with no greater
+ * element before it and no smaller one after it */
+element_t *q_nth_element(struct list_head *head, int n, bool descend)
+{
+    int cnt = q_size(head);
+    if (n < 0 || n >= cnt)
+        return NULL;
+    q_cmp_func_t cmp = default_cmp(head, descend);
+    LIST_HEAD(before);
+    LIST_HEAD(after);
+    LIST_HEAD(work);
+    list_splice_init(head, &work);
+    element_t *nth = NULL;
+
+    /* Quickselect: split the remaining range three ways around a random
+     * pivot and keep only the part holding rank n. Equal elements are never
+     * partitioned again, so duplicates do not degrade the search.
+     */
+    while (!nth) {
+        struct list_head *node = work.next;
+        for (int r = rand() % cnt; r; r--)
+            node = node->next;
+        element_t *pivot = list_entry(node, element_t, list);
+
+        LIST_HEAD(lt);
+        LIST_HEAD(eq);
+        LIST_HEAD(gt);
+        int nlt = 0, neq = 0;
+        element_t *e, *safe;
+        list_for_each_entry_safe (e, safe, &work, list) {
+            int c = cmp(NULL, e, pivot);
+            if (c < 0) {
+                list_move_tail(&e->list, &lt);
+                nlt++;
+            } else if (c > 0) {
+                list_move_tail(&e->list, &gt);
+            } else {
+                list_move_tail(&e->list, &eq);
+                neq++;
+            }
+        }
+
+        if (n < nlt) {
+            list_splice(&gt, &after);
+            list_splice(&eq, &after);
+            list_splice_init(&lt, &work);
+            cnt = nlt;
+        } else if (n < nlt + neq) {
+            list_splice_tail(&lt, &before);
+            node = eq.next;
+            for (int r = n - nlt; r; r--)
+                node = node->next;
+            nth = list_entry(node, element_t, list);
+            list_splice_tail(&eq, &before);
+            list_splice_tail(&gt, &before);
+        } else {
+            list_splice_tail(&lt, &before);
+            list_splice_tail(&eq, &before);
+            list_splice_init(&gt, &work);
+            n -= nlt + neq;
+            cnt -= nlt + neq;
+        }
+    }
+    list_splice_tail(&after, &before);
+    list_splice(&before, head);
+    return nth;
 }
 
 /* Remove every node which has a node with a strictly less value anywhere to
@@ -348,14 +1239,17 @@ int q_ascend(struct list_head *head)
         return 0;
     }
     int n = 0;
+    bool numeric = is_numeric(head);
     struct list_head *cur = head->prev;
     element_t *smallest = list_entry(cur, element_t, list);
     while (cur != head) {
         struct list_head *precur = cur->prev;
         element_t *ele = list_entry(cur, element_t, list);
-        if (strcmp(ele->value, smallest->value) > 0)
-            list_del(cur);
-        else {
+        if (cmp_element(ele, smallest, numeric) > 0) {
+            list_del_init(cur);
+            member_del(queue_of(head), ele);
+            q_release_element(ele);
+        } else {
             smallest = ele;
             n++;
         }
@@ -372,14 +1266,16 @@ int q_descend(struct list_head *head)
         return 0;
     }
     int n = 0;
+    bool numeric = is_numeric(head);
     struct list_head *cur = head->prev;
     element_t *biggest = list_entry(cur, element_t, list);
     while (cur != head) {
         struct list_head *precur = cur->prev;
         element_t *ele = list_entry(cur, element_t, list);
-        if (strcmp(ele->value, biggest->value) < 0) {
+        if (cmp_element(ele, biggest, numeric) < 0) {
             list_del_init(cur);
-            q_release_element(list_entry(cur, element_t, list));
+            member_del(queue_of(head), ele);
+            q_release_element(ele);
         } else {
             biggest = ele;
             n++;
@@ -389,10 +1285,151 @@ int q_descend(struct list_head *head)
     return n;
 }
 
+/* Prepare the elements of @src to be moved into @dst */
+static void adopt_keys(struct list_head *dst, struct list_head *src)
+{
+    element_t *ele;
+    /* Keys of elements from a string queue have never been parsed */
+    if (is_numeric(dst) && !is_numeric(src)) {
+        list_for_each_entry (ele, src, list)
+            ele->key = parse_key(ele->value);
+    }
+    /* Hand the count, index and filter entries over, src is left empty by
+     * every caller. A filter which has to grow is rebuilt for both queues at
+     * once.
+     */
+    queue_t *qd = queue_of(dst), *qs = queue_of(src);
+    if (qd->count >= 0)
+        qd->count += q_size(src);
+    if (qs->count > 0)
+        qs->count = 0;
+    bool counted = false;
+    if (qd->filter) {
+        size_t n = 0, capacity = qd->filter->capacity;
+        list_for_each_entry (ele, src, list)
+            n++;
+        while (qd->filter->count + n > capacity)
+            capacity *= 2;
+        if (capacity != qd->filter->capacity) {
+            filter_build(qd, capacity, src);
+            counted = true;
+        }
+    }
+    if (qd->index || (qd->filter && !counted)) {
+        bool numeric = is_numeric(dst);
+        list_for_each_entry (ele, src, list) {
+            uint64_t h = hash_element(ele, numeric);
+            index_add(qd, ele, h);
+            if (!counted)
+                filter_add(qd, h);
+        }
+    }
+    if (qs->index && qs->index->count) {
+        memset(qs->index->slots, 0,
+               (qs->index->mask + 1) * sizeof(index_slot_t));
+        qs->index->count = 0;
+    }
+    if (qs->filter && qs->filter->count) {
+        memset(qs->filter->counters, 0, (qs->filter->size + 1) / 2);
+        qs->filter->count = 0;
+    }
+}
+
+static inline bool gallop_passes(struct list_head *node,
+                                 const element_t *key,
+                                 q_cmp_func_t cmp,
+                                 int bias)
+{
+    return cmp(NULL, list_entry(node, element_t, list), key) < bias;
+}
+
+/* Find the first node in [@from, @end) for which cmp(node, @key) >= @bias,
+ * given that the nodes below it are exactly those failing the test. Steps of
+ * 1, 2, 4, ... nodes bracket the answer, then a binary search narrows it, so a
+ * run of r nodes costs O(log r) comparisons rather than r.
+ */
+static struct list_head *gallop(struct list_head *from,
+                                struct list_head *end,
+                                const element_t *key,
+                                q_cmp_func_t cmp,
+                                int bias)
+{
+    struct list_head *lo = from, *hi;
+    if (lo == end || !gallop_passes(lo, key, cmp, bias))
+        return lo;
+    size_t dist;
+    for (size_t step = 1;; step <<= 1) {
+        /* lo passes, look for a failing node up to step nodes after it */
+        hi = lo;
+        for (dist = 0; dist < step && hi->next != end; dist++)
+            hi = hi->next;
+        if (!dist)
+            return end;
+        if (!gallop_passes(hi, key, cmp, bias))
+            break;
+        lo = hi;
+        if (dist < step)
+            return end;
+    }
+    /* lo passes and hi fails, dist nodes apart: bisect in between */
+    while (dist > 1) {
+        size_t half = dist / 2;
+        struct list_head *mid = lo;
+        for (size_t i = 0; i < half; i++)
+            mid = mid->next;
+        if (gallop_passes(mid, key, cmp, bias)) {
+            lo = mid;
+            dist -= half;
+        } else {
+            hi = mid;
+            dist = half;
+        }
+    }
+    return hi;
+}
+
+/* Merge sorted @src into sorted @dst, leaving @src empty */
+void q_merge_sorted_into(struct list_head *dst,
+                         struct list_head *src,
+                         bool descend)
+{
+    if (!dst || !src || dst == src || list_empty(src))
+        return;
+    adopt_keys(dst, src);
+    q_cmp_func_t cmp = default_cmp(dst, descend);
+    struct list_head *pos = dst->next;
+    while (!list_empty(src)) {
+        /* Skip the nodes of dst which go before the next node of src. Equal
+         * elements already in dst stay in front.
+         */
+        element_t *s = list_first_entry(src, element_t, list);
+        pos = gallop(pos, dst, s, cmp, 1);
+        if (pos == dst) {
+            list_splice_tail_init(src, dst);
+            break;
+        }
+        /* Move the run of src which goes before that dst node in one go */
+        element_t *d = list_entry(pos, element_t, list);
+        struct list_head *end = gallop(src->next, src, d, cmp, 0);
+        LIST_HEAD(run);
+        list_cut_position(&run, src, end->prev);
+        list_splice_tail(&run, pos);
+    }
+}
+
 /* Merge all the queues into one sorted queue, which is in ascending/descending
  * order */
 // https://leetcode.com/problems/merge-k-sorted-lists/
 int q_merge(struct list_head *head, bool descend)
+{
+    if (!head || list_empty(head))
+        return 0;
+    queue_contex_t *target = list_entry(head->next, queue_contex_t, chain);
+    return q_merge_by(head, default_cmp(target->q, descend), NULL);
+}
+
+/* Merge all the queues into one queue sorted by a custom comparator */
+int q_merge_by(struct list_head *head, q_cmp_func_t cmp, void *priv)
 {
     if (!head || list_empty(head))
         return 0;
@@ -403,11 +1440,12 @@ int q_merge(struct list_head *head, bool descend)
     list_for_each_entry (que, head, chain) {
         if (que == target)
             continue;
-        list_splice_init(que->q, target->q);
+        adopt_keys(target->q, que->q);
+        list_splice_tail_init(que->q, target->q);
         target->size = target->size + que->size;
         que->size = 0;
     }
-    q_sort(target->q, descend);
+    q_sort_by(target->q, cmp, priv);
     return target->size;
 }
 
@@ -9,6 +9,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "harness.h"
 #include "list.h"
@@ -16,15 +17,45 @@
 /**
  * element_t - Linked list element
  * @value: pointer to array holding string
+ * @len: length of @value, excluding the null terminator
+ * @key: numeric key parsed from @value, valid in numeric key mode
  * @list: node of a doubly-linked list
  *
- * @value needs to be explicitly allocated and freed
+ * @value needs to be explicitly allocated and freed. @len is computed once
+ * when the element is created so that copies and comparisons never have to
+ * scan the string for its terminator.
  */
 typedef struct {
     char *value;
+    size_t len;
+    int64_t key;
     struct list_head list;
 } element_t;
 
+/**
+ * q_key_mode_t - How the elements of a queue are ordered
+ * @Q_KEY_STRING: compare values with strcmp
+ * @Q_KEY_NUMERIC: compare the 64-bit integers the values hold. The key is
+ *                 parsed once when an element enters the queue and cached in
+ *                 element_t, so ordering operations never look at the string.
+ */
+typedef enum {
+    Q_KEY_STRING,
+    Q_KEY_NUMERIC,
+} q_key_mode_t;
+
+/**
+ * q_cmp_func_t - Comparator used by q_sort_by() and q_merge_by()
+ * @priv: context pointer passed through unchanged
+ * @a: first element
+ * @b: second element
+ *
+ * Return: negative if @a goes before @b, positive if after, zero if equivalent
+ */
+typedef int (*q_cmp_func_t)(void *priv,
+                            const element_t *a,
+                            const element_t *b);
+
 /**
  * queue_contex_t - The context managing a chain of queues
  * @q: pointer to the head of the queue
@@ -48,6 +79,164 @@ typedef struct {
  */
 struct list_head *q_new();
 
+/**
+ * q_clone() - Duplicate a queue
+ * @head: header of queue
+ *
+ * The clone has its own elements in the same order and the same key mode, but
+ * shares the string of every element with @head through a reference count.
+ * Only one allocation per element is made and no string is copied. Use
+ * q_value_writable() before modifying a value in place. The clone has no
+ * index.
+ *
+ * Return: the new queue, NULL if @head is NULL or allocation failed
+ */
+struct list_head *q_clone(struct list_head *head);
+
+/**
+ * q_set_key_mode() - Select how the elements of a queue are ordered
+ * @head: header of queue
+ * @mode: key mode used by sort, merge, ascend, descend and delete_dup
+ *
+ * Switching to numeric mode parses the keys of the elements already queued.
+ * Values are parsed like strtoll() in base 10: trailing characters are
+ * ignored, strings without digits yield 0 and out of range values saturate.
+ * The index of an indexed queue is rebuilt for the new mode.
+ *
+ * Return: true for success, false if queue is NULL
+ */
+bool q_set_key_mode(struct list_head *head, q_key_mode_t mode);
+
+/**
+ * q_key_mode() - Get the key mode of a queue
+ * @head: header of queue
+ *
+ * Return: the key mode, Q_KEY_STRING if queue is NULL
+ */
+q_key_mode_t q_key_mode(struct list_head *head);
+
+/**
+ * q_set_index() - Build or drop the hash index of a queue
+ * @head: header of queue
+ * @enable: whether the queue should be indexed
+ *
+ * An indexed queue maps every value to the elements holding it, so that
+ * q_contains(), q_delete_value() and q_delete_dup() take O(1) time per value
+ * instead of scanning the list. Values are equal in the sense of the key mode:
+ * in numeric mode "7" and "007" are the same value. All q_* functions keep the
+ * index up to date, at the cost of hashing every inserted value and 16 bytes
+ * per element. If the index cannot grow on insertion it is dropped, and
+ * lookups go back to scanning.
+ *
+ * Enabling an indexed queue rebuilds its index, which is needed after values
+ * were modified in place.
+ *
+ * Return: true for success, false if queue is NULL or allocation failed, in
+ * which case the queue is left without index
+ */
+bool q_set_index(struct list_head *head, bool enable);
+
+/**
+ * q_indexed() - Tell whether a queue has a hash index
+ * @head: header of queue
+ *
+ * Return: true if q_set_index() built an index which is still in place
+ */
+bool q_indexed(struct list_head *head);
+
+/**
+ * q_set_counted() - Start or stop keeping count of the elements of a queue
+ * @head: header of queue
+ * @enable: whether the queue should keep count
+ *
+ * A counted queue updates its length on every insertion and removal, so that
+ * q_size() takes O(1) time, and the same time whatever the length, instead of
+ * walking the list. Enabling counting counts the elements once, which is
+ * needed after elements were moved in or out behind the back of the q_*
+ * functions.
+ *
+ * Return: true for success, false if queue is NULL
+ */
+bool q_set_counted(struct list_head *head, bool enable);
+
+/**
+ * q_counted() - Tell whether a queue keeps count of its elements
+ * @head: header of queue
+ *
+ * Return: true if q_set_counted() enabled counting
+ */
+bool q_counted(struct list_head *head);
+
+/**
+ * q_filter_stats_t - Size and accuracy of the filter of a queue
+ * @bytes: memory held by the filter
+ * @counters: number of 4-bit counters
+ * @hashes: counters each value is hashed to
+ * @count: number of elements counted
+ * @capacity: number of elements the filter is sized for
+ * @fp_target: false positive rate the filter is sized for
+ * @fp_estimate: false positive rate expected from the counters in use
+ */
+typedef struct {
+    size_t bytes;
+    size_t counters;
+    int hashes;
+    size_t count;
+    size_t capacity;
+    double fp_target;
+    double fp_estimate;
+} q_filter_stats_t;
+
+/**
+ * q_set_filter() - Attach or drop a counting Bloom filter
+ * @head: header of queue
+ * @fp_rate: false positive rate between 0 and 1 exclusive, other values drop
+ *           the filter
+ *
+ * The filter answers "definitely not queued" for most missing values, so that
+ * q_contains(), q_delete_value() and q_delete_dup() skip the list for them.
+ * It takes -ln(@fp_rate) / ln(2)^2 half bytes per element, 4.8 bytes at 1%,
+ * a fraction of what q_set_index() needs, but values which pass the filter
+ * still cost a scan unless the queue is indexed too. Counters make deletion
+ * possible. The filter is sized for the current length of the queue, at least
+ * 1024 elements, and rebuilt with twice the capacity whenever the queue
+ * outgrows it. If that fails, the filter is dropped.
+ *
+ * Attaching a filter again rebuilds it, which is needed after values were
+ * modified in place.
+ *
+ * Return: true for success, false if queue is NULL or allocation failed, in
+ * which case the queue is left without filter
+ */
+bool q_set_filter(struct list_head *head, double fp_rate);
+
+/**
+ * q_filter_stats() - Report the size and accuracy of the filter of a queue
+ * @head: header of queue
+ * @stats: filled in if not NULL
+ *
+ * Return: true if the queue has a filter, false otherwise
+ */
+bool q_filter_stats(struct list_head *head, q_filter_stats_t *stats);
+
+/**
+ * q_contains() - Tell whether a queue holds a value
+ * @head: header of queue
+ * @s: value to look for, compared according to the key mode
+ *
+ * Return: true if an element holds @s, false if none or queue is NULL
+ */
+bool q_contains(struct list_head *head, const char *s);
+
+/**
+ * q_delete_value() - Delete every element holding a value
+ * @head: header of queue
+ * @s: value to delete, compared according to the key mode
+ *
+ * Return: the number of elements deleted
+ */
+int q_delete_value(struct list_head *head, const char *s);
+
 /**
  * q_free() - Free all storage used by queue, no effect if header is NULL
  * @head: header of queue
@@ -108,6 +297,17 @@ element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize);
  */
 element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize);
 
+/**
+ * q_value_put() - Drop a reference to the value of an element
+ * @value: value of the element
+ * @len: length of @value
+ *
+ * Values are shared between clones made by q_clone() and freed along with the
+ * last element referring to them. This function is intended for internal use
+ * only.
+ */
+void q_value_put(char *value, size_t len);
+
 /**
  * q_release_element() - Release the element
  * @e: element would be released
@@ -116,14 +316,57 @@ element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize);
  */
 static inline void q_release_element(element_t *e)
 {
-    test_free(e->value);
+    q_value_put(e->value, e->len);
     test_free(e);
 }
 
+/**
+ * q_element_set() - Store a copy of a string in an element
+ * @e: element whose value is set
+ * @s: string to copy
+ * @mode: key mode of the container, the numeric key is parsed if
+ *        Q_KEY_NUMERIC
+ *
+ * The previous value of @e, if any, is not released.
+ *
+ * Return: true for success, false for allocation failed
+ */
+bool q_element_set(element_t *e, const char *s, q_key_mode_t mode);
+
+/**
+ * q_insert_tail_copy() - Insert a copy of a prepared element at tail of queue
+ * @head: header of queue
+ * @e: element whose value, length and key are copied
+ *
+ * Same as q_insert_tail() with the value of @e, except that its length and
+ * key are taken from @e instead of being computed again. The key of @e must
+ * follow the key mode of the queue. This function is intended for internal
+ * use only.
+ *
+ * Return: true for success, false if allocation failed or queue is NULL
+ */
+bool q_insert_tail_copy(struct list_head *head, const element_t *e);
+
+/**
+ * q_value_writable() - Prepare the value of an element for modification
+ * @e: element about to be modified
+ *
+ * Copy-on-write: a value shared with clones is first replaced by a private
+ * copy, so that modifying it in place leaves the other queues untouched. The
+ * length of the value must not change, and the key cached in numeric key mode
+ * is not parsed again.
+ *
+ * Return: the value to modify, NULL if @e is NULL or allocation failed
+ */
+char *q_value_writable(element_t *e);
+
 /**
  * q_size() - Get the size of the queue
  * @head: header of queue
  *
+ * Takes O(1) time on a counted queue, see q_set_counted(), and walks the list
+ * otherwise.
+ *
  * Return: the number of elements in queue, zero if queue is NULL or empty
  */
 int q_size(struct list_head *head);
@@ -148,6 +391,9 @@ bool q_delete_mid(struct list_head *head);
  *                  leaving only distinct strings from the original queue.
  * @head: header of queue
  *
+ * Duplicates need not be adjacent. An indexed queue is processed in O(n)
+ * time. With a filter, values it proves unique are not searched for.
+ *
  * Reference:
  * https://leetcode.com/problems/remove-duplicates-from-sorted-list-ii/
  *
@@ -200,6 +446,81 @@ void q_reverseK(struct list_head *head, int k);
  */
 void q_sort(struct list_head *head, bool descend);
 
+/**
+ * q_sort_by() - Sort elements of queue with a custom comparator
+ * @head: header of queue
+ * @cmp: comparator deciding the order
+ * @priv: context pointer passed to @cmp
+ *
+ * The sort is stable: elements @cmp considers equivalent keep their relative
+ * order. No effect if queue is NULL or empty.
+ */
+void q_sort_by(struct list_head *head, q_cmp_func_t cmp, void *priv);
+
+/**
+ * q_cmp_string() - Order elements by strcmp
+ * @priv: unused
+ * @a: first element
+ * @b: second element
+ */
+int q_cmp_string(void *priv, const element_t *a, const element_t *b);
+
+/**
+ * q_cmp_numeric() - Order elements by the keys cached in numeric key mode
+ * @priv: unused
+ * @a: first element
+ * @b: second element
+ */
+int q_cmp_numeric(void *priv, const element_t *a, const element_t *b);
+
+/**
+ * q_cmp_casefold() - Order elements by strcasecmp
+ * @priv: unused
+ * @a: first element
+ * @b: second element
+ */
+int q_cmp_casefold(void *priv, const element_t *a, const element_t *b);
+
+/**
+ * q_cmp_length() - Order elements by length, then by strcmp
+ * @priv: unused
+ * @a: first element
+ * @b: second element
+ *
+ * Strings of different lengths are ordered without calling strcmp at all.
+ */
+int q_cmp_length(void *priv, const element_t *a, const element_t *b);
+
+/**
+ * q_topk() - Move the k smallest or largest elements to the front in order
+ * @head: header of queue
+ * @k: number of elements wanted
+ * @descend: whether to keep the largest instead of the smallest elements
+ *
+ * The first k elements end up sorted like q_sort() would sort them, and the
+ * order of the others is unspecified. Elements are sorted in batches of k and
+ * merged into the best k seen so far, so this takes O(n log k) time instead of
+ * the O(n log n) of a full sort. No allocation is performed.
+ *
+ * Return: the number of elements sorted at the front, at most @k
+ */
+int q_topk(struct list_head *head, int k, bool descend);
+
+/**
+ * q_nth_element() - Partially sort queue around the element of a given rank
+ * @head: header of queue
+ * @n: 0-based rank of the wanted element
+ * @descend: whether ranks count from the largest element
+ *
+ * Afterwards the nth node holds the element a full sort would put there,
+ * elements before it are not greater and elements after it are not smaller
+ * (reversed when @descend). Uses quickselect with a random pivot: O(n)
+ * expected time, no allocation.
+ *
+ * Return: the nth element, NULL if queue is NULL or @n is out of range
+ */
+element_t *q_nth_element(struct list_head *head, int n, bool descend);
+
 /**
  * q_ascend() - Remove every node which has a node with a strictly less
  * value anywhere to the right side of it.
@@ -250,4 +571,35 @@ int q_descend(struct list_head *head);
  */
 int q_merge(struct list_head *head, bool descend);
 
+/**
+ * q_merge_sorted_into() - Merge a sorted queue into another sorted queue
+ * @dst: header of the sorted queue receiving the elements
+ * @src: header of the sorted batch, left empty afterwards
+ * @descend: whether both queues are sorted in descending order
+ *
+ * Takes O(n + m) time by splicing, instead of appending @src and sorting
+ * everything again. Runs of consecutive elements coming from the same queue
+ * are found by galloping, so long runs cost a logarithmic number of
+ * comparisons and move as a single splice. The merge is stable: elements of
+ * @dst go before equal elements of @src. No allocation is performed.
+ */
+void q_merge_sorted_into(struct list_head *dst,
+                         struct list_head *src,
+                         bool descend);
+
+/**
+ * q_merge_by() - Merge all the queues into one queue sorted by a custom
+ * comparator
+ * @head: header of chain
+ * @cmp: comparator deciding the order
+ * @priv: context pointer passed to @cmp
+ *
+ * Same as q_merge(), except that the queues are expected to be sorted by @cmp.
+ * The merge is stable: equal elements keep the order of their queues in the
+ * chain, then their order within each queue.
+ *
+ * Return: the number of elements in queue after merging
+ */
+int q_merge_by(struct list_head *head, q_cmp_func_t cmp, void *priv);
+
 #endif /* LAB0_QUEUE_H */
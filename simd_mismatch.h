@@ -0,0 +1,148 @@
+#ifndef LAB0_SIMD_MISMATCH_H
+#define LAB0_SIMD_MISMATCH_H
+
+/* Vectorized search for the first byte where two strings differ, which the C
+ * library has no counterpart for. Frozen queues use it to measure the prefix
+ * neighbouring strings share.
+ *
+ * Elements cache the length of their value, so the search knows up front how
+ * many bytes it may read. Every load stays within the two strings: full
+ * vectors are compared first, then the remainder is covered by one vector or
+ * word which overlaps bytes already known to be equal. Nothing past the
+ * terminator is ever touched, so strings ending next to an unmapped page are
+ * handled without special cases and the memory checkers stay quiet.
+ *
+ * The vector width follows the targets supported by dudect/cpucycles.h:
+ * 16 bytes with SSE2 on x86-64 and NEON on Arm64, and a portable
+ * word-at-a-time loop otherwise.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+/* Load 8 or 4 bytes without alignment requirements */
+static inline uint64_t simd_load64(const char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t simd_load32(const char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/* Index of the first byte which differs between two words loaded from
+ * memory, assuming they are not equal
+ */
+static inline size_t simd_first_diff64(uint64_t x, uint64_t y)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return __builtin_ctzll(x ^ y) >> 3;
+#else
+    return __builtin_clzll(x ^ y) >> 3;
+#endif
+}
+
+static inline size_t simd_first_diff32(uint32_t x, uint32_t y)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return __builtin_ctz(x ^ y) >> 3;
+#else
+    return __builtin_clz(x ^ y) >> 3;
+#endif
+}
+
+/* Compare @n bytes which are all in bounds, 8 at a time. Returns the index of
+ * the first mismatch, or @n if the ranges are equal.
+ */
+static inline size_t simd_mismatch_words(const char *a,
+                                         const char *b,
+                                         size_t i,
+                                         size_t n)
+{
+    for (; i + 8 <= n; i += 8) {
+        uint64_t x = simd_load64(a + i), y = simd_load64(b + i);
+        if (x != y)
+            return i + simd_first_diff64(x, y);
+    }
+    if (i == n)
+        return n;
+    if (n >= 8) {
+        /* Overlap the last word with bytes already compared */
+        uint64_t x = simd_load64(a + n - 8), y = simd_load64(b + n - 8);
+        return x != y ? n - 8 + simd_first_diff64(x, y) : n;
+    }
+    if (n >= 4) {
+        /* Two possibly overlapping halves cover 4 to 7 bytes */
+        uint32_t x = simd_load32(a), y = simd_load32(b);
+        if (x != y)
+            return simd_first_diff32(x, y);
+        x = simd_load32(a + n - 4);
+        y = simd_load32(b + n - 4);
+        return x != y ? n - 4 + simd_first_diff32(x, y) : n;
+    }
+    for (; i < n; i++) {
+        if (a[i] != b[i])
+            return i;
+    }
+    return n;
+}
+
+#if defined(__SSE2__)
+#define SIMD_VEC_BYTES 16
+/* Index of the first differing byte of two 16-byte blocks, 16 if equal */
+static inline size_t simd_first_diff16(const char *a, const char *b)
+{
+    __m128i x = _mm_loadu_si128((const __m128i *) a);
+    __m128i y = _mm_loadu_si128((const __m128i *) b);
+    uint32_t ne = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xffff;
+    return ne ? (size_t) __builtin_ctz(ne) : 16;
+}
+#elif defined(__aarch64__)
+#define SIMD_VEC_BYTES 16
+static inline size_t simd_first_diff16(const char *a, const char *b)
+{
+    uint8x16_t eq = vceqq_u8(vld1q_u8((const uint8_t *) a),
+                             vld1q_u8((const uint8_t *) b));
+    if (vminvq_u8(eq) == 0xff)
+        return 16;
+    /* Narrow every comparison byte to a nibble of a 64-bit word */
+    uint64_t nibbles = vget_lane_u64(
+        vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+    return __builtin_ctzll(~nibbles) >> 2;
+}
+#endif
+
+/* Return the index of the first differing byte within @n bytes of @a and @b,
+ * or @n if they are equal. Only bytes below @n are read.
+ */
+static inline size_t simd_mismatch(const char *a, const char *b, size_t n)
+{
+    size_t i = 0;
+#if defined(SIMD_VEC_BYTES)
+    for (; i + SIMD_VEC_BYTES <= n; i += SIMD_VEC_BYTES) {
+        size_t k = simd_first_diff16(a + i, b + i);
+        if (k < SIMD_VEC_BYTES)
+            return i + k;
+    }
+    if (i != n && n >= SIMD_VEC_BYTES) {
+        /* Overlap the last vector with bytes already compared */
+        size_t last = n - SIMD_VEC_BYTES;
+        return last + simd_first_diff16(a + last, b + last);
+    }
+#endif
+    return simd_mismatch_words(a, b, i, n);
+}
+
+#endif /* LAB0_SIMD_MISMATCH_H */
@@ -0,0 +1,13 @@
+# Test of typed queues with int64 and fixed-size record payloads
+option fail 0
+option malloc 0
+typed int64 1
+typed record 2
+typed int64 1000
+typed record 1000
+option descend 1
+typed int64 1000
+typed record 1000
+option descend 0
+typed int64 100000
+typed record 100000
@@ -0,0 +1,69 @@
+# Test of sort, dedup, ascend, descend and merge on numeric keys
+option fail 0
+option malloc 0
+option numeric 1
+new
+it 10
+it 9
+it 100
+it -5
+it 20
+sort
+rh -5
+rh 9
+rh 10
+rh 20
+rh 100
+ih 7
+ih 42
+ih 007
+ih 3
+ih 42
+ih 8
+sort
+dedup
+rh 3
+rh 8
+size
+ih 5
+ih 1
+ih 30
+ih 2
+ih 4
+descend
+rh 30
+rh 5
+free
+new
+ih 12
+ih 300
+ih 2
+ascend
+rh 2
+rh 12
+free
+new
+it 1
+it 30
+it 200
+new
+it 4
+it 50
+it 600
+merge
+rh 1
+rh 4
+rh 30
+rh 50
+rh 200
+rh 600
+free
+new
+ih RAND 1000
+sort
+option descend 1
+sort
+option descend 0
+option numeric 0
+sort
+free
@@ -0,0 +1,92 @@
+# Test of sorting with pluggable comparators
+option fail 0
+option malloc 0
+new
+ih bb
+ih Ab
+ih ccc
+ih a
+ih aB
+sortby length
+rh a
+rh Ab
+rh aB
+rh bb
+rh ccc
+ih Zeta
+ih alpha
+ih Beta
+sortby casefold
+rh alpha
+rh Beta
+rh Zeta
+ih Zeta
+ih alpha
+ih Beta
+sortby string
+rh Beta
+rh Zeta
+rh alpha
+it Ab
+it aB
+it AB
+it ab
+sortby casefold
+rh Ab
+rh aB
+rh AB
+rh ab
+ih RAND 10000
+sortby length
+sortby casefold
+sortby string
+free
+new
+it Beta
+it alpha
+it BETA
+sortby casefold
+new
+it ALPHA
+it beta
+it gamma
+new
+it Alpha
+mergeby casefold
+rh alpha
+rh ALPHA
+rh Alpha
+rh Beta
+rh BETA
+rh beta
+rh gamma
+ih RAND 1000
+sortby casefold
+new
+ih RAND 1000
+sortby casefold
+new
+ih RAND 1000
+sortby casefold
+mergeby casefold
+free
+option numeric 1
+new
+it 100
+it 9
+it 10
+sortby numeric
+rh 9
+rh 10
+rh 100
+it 5
+it 7
+new
+it 3
+it 7
+mergeby numeric
+rh 3
+rh 5
+rh 7
+rh 7
+free
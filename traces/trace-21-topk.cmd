@@ -0,0 +1,40 @@
+# Test of q_topk and q_nth_element
+option fail 0
+option malloc 0
+new
+it e
+it b
+it d
+it a
+it c
+it b
+topk 0
+topk 3
+rh a
+rh b
+rh b
+nth 0 c
+nth 2 e
+nth 3
+ih RAND 10000
+topk 100
+nth 5000
+nth 0
+nth 10002
+option descend 1
+topk 10
+nth 9999
+free
+option descend 0
+option numeric 1
+new
+it 100
+it 9
+it -3
+it 10
+it 42
+topk 2
+rh -3
+rh 9
+nth 1 42
+free
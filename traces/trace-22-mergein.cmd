@@ -0,0 +1,68 @@
+# Test of merging a sorted batch into a sorted queue
+option fail 0
+option malloc 0
+new
+it a
+it c
+it e
+it g
+new
+it b
+it c
+it d
+it h
+it i
+mergein
+rh a
+rh b
+rh c
+rh c
+rh d
+rh e
+rh g
+rh h
+rh i
+ih RAND 5000
+sort
+new
+ih RAND 3000
+sort
+mergein
+new
+mergein
+size
+free
+option descend 1
+new
+it z
+it m
+new
+it y
+it x
+it a
+mergein
+rh z
+rh y
+rh x
+rh m
+rh a
+free
+option descend 0
+new
+it 12
+it 13
+it 50
+new
+option numeric 1
+it -5
+it 7
+it 100
+prev
+mergein
+rh -5
+rh 7
+rh 12
+rh 13
+rh 50
+rh 100
+free
@@ -0,0 +1,31 @@
+# Test of sorting through temporary files
+option fail 0
+option malloc 0
+option sortmem 64
+new
+it d
+it b
+it c
+it a
+sort
+rh a
+rh b
+rh c
+rh d
+ih RAND 5000
+sort
+ih RAND 40000
+sort
+option descend 1
+sort
+free
+option descend 0
+option numeric 1
+new
+ih RAND 20000
+it 5
+it -12
+it 100
+sort
+free
+option sortmem 0
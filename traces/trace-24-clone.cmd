@@ -0,0 +1,42 @@
+# Test of cloning queues with shared strings
+option fail 0
+option malloc 0
+new
+it apple
+it banana
+it cherry
+clone
+upcase
+rh APPLE
+prev
+rh apple
+next
+rh BANANA
+free
+rh banana
+ih RAND 1000
+clone
+free
+clone
+dedup
+free
+size
+free
+new
+ih RAND 100
+option fail 10
+option malloc 5
+clone
+clone
+option malloc 0
+free
+option numeric 1
+new
+it 10
+it 9
+clone
+sort
+rh 9
+rh 10
+free
+free
@@ -0,0 +1,22 @@
+# Test of freeing queues on a background thread
+option fail 0
+option malloc 0
+option deferfree 1
+new
+ih RAND 10000
+clone
+new
+it a
+it b
+prev
+free
+rh
+free
+it c
+new
+ih dolphin 50000
+clone
+free
+free
+free
+option deferfree 0
@@ -0,0 +1,32 @@
+# Test of reverseK with partial tails and out of range k
+option fail 0
+option malloc 0
+new
+it 1
+it 2
+it 3
+it 4
+it 5
+it 6
+it 7
+reverseK 3
+reverseK 8
+reverseK 1
+reverseK 0
+reverseK 7
+rh 7
+rh 4
+rh 5
+rh 6
+rh 1
+rh 2
+rh 3
+it a
+reverseK 2
+rh a
+ih RAND 10000
+reverseK 100
+reverseK 10000
+reverseK 10001
+size
+free
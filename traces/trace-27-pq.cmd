@@ -0,0 +1,42 @@
+# Test of priority queue push, pop, decrease-key and meld
+option fail 0
+option malloc 0
+pqpush dolphin
+pqpush bear
+pqpush gerbil
+pqpush meerkat
+pqpush ant
+pqpop ant
+pqdec meerkat aardvark
+pqdec gerbil zebra
+pqpop aardvark
+pqpop bear
+pqpush cat
+pqpop cat
+pqpop dolphin
+pqpop gerbil
+# Popping an empty priority queue counts as a failure
+option fail 10
+pqpop
+option fail 0
+pqpush RAND 20
+pqmeld 20
+pqpop
+pqpop
+pqpop
+pqfree
+option numeric 1
+pqpush 100
+pqpush 9
+pqpush -3
+pqpush 42
+pqdec 100 7
+pqpop -3
+pqpop 7
+pqpop 9
+pqpop 42
+pqpush RAND 500
+pqmeld 500
+pqpop
+pqpop
+pqpop
@@ -0,0 +1,54 @@
+# Test of lookups and deletions by value with and without hash index
+option fail 0
+option malloc 0
+new
+ih dolphin
+ih bear
+ih gerbil
+ih bear
+contains bear
+contains cat
+delval bear
+contains bear
+delval cat
+option index 1
+ih cat
+ih gerbil
+it meerkat
+contains gerbil
+contains cat
+delval gerbil
+contains gerbil
+rh cat
+contains cat
+it zebra
+it zebra
+it ant
+dedup
+contains zebra
+dm
+contains meerkat
+rh dolphin
+rh ant
+new
+it aardvark
+it elephant
+merge
+contains elephant
+delval aardvark
+option numeric 1
+it 7
+it 007
+contains 0007
+delval 7
+contains 7
+ih RAND 10000
+it 42
+contains 42
+sort
+contains 42
+reverse
+delval 42
+ascend
+upcase
+free
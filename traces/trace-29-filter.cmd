@@ -0,0 +1,50 @@
+# Test of Bloom filter prefiltering lookups, deletions and dedup
+option fail 0
+option malloc 0
+option filter 10
+new
+ih dolphin
+ih bear
+ih gerbil
+ih bear
+contains bear
+contains cat
+delval bear
+contains bear
+delval cat
+ih gerbil
+it zebra
+it zebra
+it ant
+sort
+dedup
+contains gerbil
+contains zebra
+contains ant
+rh ant
+contains ant
+dm
+filter
+option index 1
+it cat
+contains cat
+delval cat
+option index 0
+ih RAND 3000
+filter
+new
+it elephant
+it aardvark
+merge
+contains elephant
+contains aardvark
+option numeric 1
+it 7
+it 007
+contains 0007
+delval 7
+contains 7
+upcase
+option filter 0
+contains dolphin
+free
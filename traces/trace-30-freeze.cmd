@@ -0,0 +1,69 @@
+# Test of freezing sorted queues into front-coded storage
+option fail 0
+option malloc 0
+new
+it apple
+it applesauce
+it applet
+it application
+it apply
+it banana
+it bandana
+it band
+it bandwidth
+it cat
+it catalog
+it catalogue
+it category
+it cattle
+it dog
+it dogma
+it dogmatic
+it doghouse
+it dot
+it dote
+sort
+freeze
+ffind apple
+ffind applet
+ffind apricot
+ffind aardvark
+ffind bandwidth
+ffind cattle
+ffind dot
+ffind dote
+ffind zebra
+thaw
+rh apple
+rh applesauce
+rh applet
+option descend 1
+sort
+freeze
+ffind dote
+ffind cat
+ffind a
+ffind zzz
+thaw
+rh dote
+option descend 0
+ih RAND 1000
+sort
+freeze
+thaw
+option numeric 1
+free
+new
+it 5
+it 12
+it 100
+it 1000
+it 20
+sort
+freeze
+ffind 012
+ffind 21
+ffind 99999
+thaw
+rh 5
+free
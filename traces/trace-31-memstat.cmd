@@ -0,0 +1,18 @@
+# Test of allocation profiling, overall and per command
+option fail 0
+option malloc 0
+memstat
+new
+memstat ih dolphin 1000
+memstat it abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ 1000
+ih gerbil
+memstat sort
+memstat rh abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ
+memstat dedup
+memstat size
+memstat ih RAND 500
+option deferfree 1
+memstat free
+option deferfree 0
+memstat memstat new
+memstat
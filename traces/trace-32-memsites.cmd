@@ -0,0 +1,16 @@
+# Test of attributing allocations to call sites
+option fail 0
+option malloc 0
+new
+ih RAND 100
+it dolphin 10
+pqpush bear 5
+memsites
+memsites 2
+option sitedepth 4
+ih gerbil 3
+memsites 3
+option sitedepth 1
+pqfree
+free
+memsites
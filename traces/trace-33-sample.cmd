@@ -0,0 +1,25 @@
+# Test of queue operations with a sample of blocks fully checked
+option fail 0
+option malloc 0
+option sample 4
+new
+ih RAND 1000
+it dolphin 100
+ih gerbil 100
+rh
+rt dolphin
+sort
+dedup
+reverse
+swap
+memstat
+free
+option sample 1
+new
+ih bear 10
+option sample 8
+it meerkat 10
+rh bear
+option sample 1
+rt meerkat
+free
@@ -0,0 +1,14 @@
+# Test of growing buffers with realloc, through the search stack of pqdec
+option fail 0
+option malloc 0
+pqpush dolphin
+pqpush RAND 200
+memstat pqdec dolphin aardvark
+pqpop
+option sample 4
+pqpush meerkat
+pqpush RAND 200
+pqdec meerkat aardvark
+option sample 1
+pqpop
+pqfree
@@ -0,0 +1,10 @@
+# Test of sorting within a latency budget tighter than a second
+option fail 0
+option malloc 0
+new
+ih RAND 100000
+option budget 400000
+budget sort
+budget reverse
+option budget 1000000
+free
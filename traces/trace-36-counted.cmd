@@ -0,0 +1,45 @@
+# Test of counted queues, which must stay in step with every operation
+option fail 0
+option malloc 0
+option counted 1
+new
+ih RAND 200
+it dolphin 3
+size
+rh
+rt dolphin
+dm
+dedup
+size
+delval dolphin
+ascend
+size
+it meerkat
+it bear
+it gerbil
+descend
+size
+clone
+it vulture
+size
+new
+it RAND 50
+sort
+merge
+size
+option sortmem 4
+it RAND 2000
+sort
+size
+option sortmem 0
+new
+it aardvark
+it zebra
+mergein
+size
+option counted 0
+it dolphin
+size
+option counted 1
+size
+free
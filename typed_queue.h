@@ -0,0 +1,232 @@
+#ifndef LAB0_TYPED_QUEUE_H
+#define LAB0_TYPED_QUEUE_H
+
+/* Typed queues generated at compile time.
+ *
+ * element_t only carries heap-allocated strings compared with strcmp. For
+ * other payloads, DEFINE_QUEUE() generates a queue whose nodes embed the
+ * payload directly, together with insert, remove, sort and merge routines
+ * specialized for that payload type. The comparator is expanded in place, so
+ * the compiler can inline it instead of calling through a function pointer.
+ *
+ * Example:
+ *   #define int64_cmp(a, b) ((*(a) > *(b)) - (*(a) < *(b)))
+ *   DEFINE_QUEUE(i64q, int64_t, int64_cmp)
+ *
+ * generates i64q_element_t, i64q_new(), i64q_free(), i64q_insert_head(),
+ * i64q_insert_tail(), i64q_remove_head(), i64q_remove_tail(), i64q_size(),
+ * i64q_compare(), i64q_sort() and i64q_merge().
+ *
+ * The comparator receives two pointers to the payload type and returns a
+ * negative, zero or positive value like strcmp. Sorting is stable.
+ *
+ * Nodes are allocated through test_malloc() and test_free() so that typed
+ * queues are checked by the harness like element_t based ones.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "harness.h"
+#include "list.h"
+
+/* Enough pending runs for any list which fits in the address space */
+#define TQ_MAX_PENDING (sizeof(size_t) * 8)
+
+/**
+ * tq_linearize() - Detach the nodes of a queue as a NULL-terminated list
+ * @head: header of queue
+ *
+ * Only the next pointers of the returned list are meaningful. @head is left
+ * untouched and has to be rebuilt with tq_rebuild().
+ *
+ * Return: the first node, NULL if queue is empty
+ */
+static inline struct list_head *tq_linearize(struct list_head *head)
+{
+    if (list_empty(head))
+        return NULL;
+    head->prev->next = NULL;
+    return head->next;
+}
+
+/**
+ * tq_rebuild() - Link a NULL-terminated list back into a circular queue
+ * @head: header of queue
+ * @list: first node of the list, NULL for an empty queue
+ *
+ * Restores every prev pointer which was invalidated while the nodes were
+ * chained through next only.
+ */
+static inline void tq_rebuild(struct list_head *head, struct list_head *list)
+{
+    struct list_head *prev = head;
+    for (; list; prev = list, list = list->next) {
+        prev->next = list;
+        list->prev = prev;
+    }
+    prev->next = head;
+    head->prev = prev;
+}
+
+/**
+ * DEFINE_QUEUE() - Generate a typed queue
+ * @name: prefix of the generated type and functions
+ * @type: payload type embedded in every node
+ * @cmp: comparator, a function or function-like macro taking two
+ *       'const @type *' arguments
+ */
+#define DEFINE_QUEUE(name, type, cmp)                                         \
+    typedef struct {                                                          \
+        type value;                                                           \
+        struct list_head list;                                                \
+    } name##_element_t;                                                       \
+                                                                              \
+    static inline struct list_head *name##_new(void)                          \
+    {                                                                         \
+        struct list_head *head = test_malloc(sizeof(struct list_head));       \
+        if (!head)                                                            \
+            return NULL;                                                      \
+        INIT_LIST_HEAD(head);                                                 \
+        return head;                                                          \
+    }                                                                         \
+                                                                              \
+    static inline void name##_free(struct list_head *head)                    \
+    {                                                                         \
+        if (!head)                                                            \
+            return;                                                           \
+        struct list_head *node, *safe;                                        \
+        list_for_each_safe (node, safe, head)                                 \
+            test_free(list_entry(node, name##_element_t, list));              \
+        test_free(head);                                                      \
+    }                                                                         \
+                                                                              \
+    static inline name##_element_t *name##_alloc(const type *value)           \
+    {                                                                         \
+        name##_element_t *e = test_malloc(sizeof(name##_element_t));          \
+        if (e)                                                                \
+            e->value = *value;                                                \
+        return e;                                                             \
+    }                                                                         \
+                                                                              \
+    static inline bool name##_insert_head(struct list_head *head, type value) \
+    {                                                                         \
+        name##_element_t *e;                                                  \
+        if (!head || !(e = name##_alloc(&value)))                             \
+            return false;                                                     \
+        list_add(&e->list, head);                                             \
+        return true;                                                          \
+    }                                                                         \
+                                                                              \
+    static inline bool name##_insert_tail(struct list_head *head, type value) \
+    {                                                                         \
+        name##_element_t *e;                                                  \
+        if (!head || !(e = name##_alloc(&value)))                             \
+            return false;                                                     \
+        list_add_tail(&e->list, head);                                        \
+        return true;                                                          \
+    }                                                                         \
+                                                                              \
+    static inline bool name##_remove(struct list_head *node, type *value)     \
+    {                                                                         \
+        name##_element_t *e = list_entry(node, name##_element_t, list);       \
+        list_del(node);                                                       \
+        if (value)                                                            \
+            *value = e->value;                                                \
+        test_free(e);                                                         \
+        return true;                                                          \
+    }                                                                         \
+                                                                              \
+    static inline bool name##_remove_head(struct list_head *head,             \
+                                          type *value)                        \
+    {                                                                         \
+        if (!head || list_empty(head))                                        \
+            return false;                                                     \
+        return name##_remove(head->next, value);                              \
+    }                                                                         \
+                                                                              \
+    static inline bool name##_remove_tail(struct list_head *head,             \
+                                          type *value)                        \
+    {                                                                         \
+        if (!head || list_empty(head))                                        \
+            return false;                                                     \
+        return name##_remove(head->prev, value);                              \
+    }                                                                         \
+                                                                              \
+    static inline int name##_size(struct list_head *head)                     \
+    {                                                                         \
+        if (!head)                                                            \
+            return 0;                                                         \
+        int size = 0;                                                         \
+        struct list_head *node;                                               \
+        list_for_each (node, head)                                            \
+            size++;                                                           \
+        return size;                                                          \
+    }                                                                         \
+                                                                              \
+    static inline int name##_compare(const struct list_head *a,               \
+                                     const struct list_head *b)               \
+    {                                                                         \
+        return cmp(&list_entry(a, name##_element_t, list)->value,             \
+                   &list_entry(b, name##_element_t, list)->value);            \
+    }                                                                         \
+                                                                              \
+    /* Merge two NULL-terminated lists, @a wins ties to keep stability */     \
+    static inline struct list_head *name##_merge_list(                        \
+        struct list_head *a, struct list_head *b, bool descend)               \
+    {                                                                         \
+        struct list_head *head = NULL, **tail = &head;                        \
+        while (a && b) {                                                      \
+            int c = name##_compare(a, b);                                     \
+            if (descend ? c >= 0 : c <= 0) {                                  \
+                *tail = a;                                                    \
+                tail = &a->next;                                              \
+                a = a->next;                                                  \
+            } else {                                                          \
+                *tail = b;                                                    \
+                tail = &b->next;                                              \
+                b = b->next;                                                  \
+            }                                                                 \
+        }                                                                     \
+        *tail = a ? a : b;                                                    \
+        return head;                                                          \
+    }                                                                         \
+                                                                              \
+    /* Bottom-up merge sort: pending[i] holds a sorted run of 2^i nodes */    \
+    static inline void name##_sort(struct list_head *head, bool descend)      \
+    {                                                                         \
+        if (!head || list_empty(head) || list_is_singular(head))              \
+            return;                                                           \
+        struct list_head *pending[TQ_MAX_PENDING] = {NULL};                   \
+        struct list_head *list = tq_linearize(head);                          \
+        while (list) {                                                        \
+            struct list_head *next = list->next;                              \
+            list->next = NULL;                                                \
+            size_t i;                                                         \
+            for (i = 0; pending[i]; i++) {                                    \
+                list = name##_merge_list(pending[i], list, descend);          \
+                pending[i] = NULL;                                            \
+            }                                                                 \
+            pending[i] = list;                                                \
+            list = next;                                                      \
+        }                                                                     \
+        for (size_t i = 0; i < TQ_MAX_PENDING; i++) {                         \
+            if (pending[i])                                                   \
+                list = name##_merge_list(pending[i], list, descend);          \
+        }                                                                     \
+        tq_rebuild(head, list);                                               \
+    }                                                                         \
+                                                                              \
+    /* Merge sorted @src into sorted @dst, leaving @src empty */              \
+    static inline void name##_merge(struct list_head *dst,                    \
+                                    struct list_head *src, bool descend)      \
+    {                                                                         \
+        if (!dst || !src || list_empty(src))                                  \
+            return;                                                           \
+        struct list_head *list = name##_merge_list(                           \
+            tq_linearize(dst), tq_linearize(src), descend);                   \
+        INIT_LIST_HEAD(src);                                                  \
+        tq_rebuild(dst, list);                                                \
+    }
+
+#endif /* LAB0_TYPED_QUEUE_H */